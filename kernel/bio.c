@@ -1,10 +1,24 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Each buffer lives on the bucket list that its (dev, blockno)
+// hashes to, and each bucket has its own lock, so lookups of
+// different blocks don't contend.  A buffer moves to another
+// bucket only when it is recycled for a new block.
+//
+// The cache is not of fixed size.  Buffers come in groups of
+// BPG, whose data share one page from kalloc().  binit()
+// allocates NBUF buffers; after that, a miss adds a group
+// rather than recycle a cached block, until the cache holds
+// 1/BCACHEFRAC of memory.  Buffers that hold no block yet are
+// spares, on a list of their own.  When kalloc() runs out of
+// memory it calls bshrink(), which frees groups whose buffers
+// are all unused, down to NBUF buffers.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -12,80 +26,435 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To overlap several disk operations, call bsubmit on each
+//     locked buffer (or bsubmitv on an array of them) and then
+//     bwait on each of them.
+// * A process that holds several buffers of file data at once
+//     must lock them in ascending block order, as breadn does.
+// * bprefetch starts reading blocks that will be wanted soon;
+//     it does not wait, and leaves nothing for the caller to release.
+//
+// Lock order: bcache.glock, then bucket locks in address
+// order, then bcache.lock.
 
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
 
-struct {
+#define NBUCKET 251
+#define BHASH(dev, blockno) (((uint)(dev) * 31 + (uint)(blockno)) % NBUCKET)
+#define BPG (PGSIZE / BSIZE)  // buffers per group
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;  // circular list of the bucket's buffers
+};
+
+struct bgroup {
+  struct buf buf[BPG];
+  struct bgroup *next;
+};
+
+#define GPP (PGSIZE / sizeof(struct bgroup))  // groups per page
+
+struct {
+  struct spinlock lock;   // protects spare
+  struct buf spare;       // buffers that hold no block, dev 0
+
+  struct spinlock glock;  // protects the rest
+  struct bgroup *groups;  // groups with data pages
+  struct bgroup *free;    // groups without
+  int nbuf;               // buffers in groups
+  int maxbuf;
+
+  uint hits;              // bget() found the block cached
+  uint misses;            // bget() had to assign it a buffer
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket *
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[BHASH(dev, blockno)];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+blink(struct buf *head, struct buf *b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+// Add a group of spare buffers, if the cache may grow and
+// there is memory.  Returns 1 if it did, 0 if not.
+static int
+bgrow(void)
+{
+  struct bgroup *g;
+  struct buf *b;
+  char *pg;
+  int i;
+
+  acquire(&bcache.glock);
+  if(bcache.nbuf + BPG > bcache.maxbuf){
+    release(&bcache.glock);
+    return 0;
+  }
+  bcache.nbuf += BPG;
+  if((g = bcache.free) != 0)
+    bcache.free = g->next;
+  release(&bcache.glock);
+
+  if(g == 0 && (g = (struct bgroup*)kalloc()) != 0){
+    // carve a page into groups; keep the first.
+    memset(g, 0, PGSIZE);
+    for(i = 0; i < GPP; i++)
+      for(b = g[i].buf; b < g[i].buf + BPG; b++)
+        initsleeplock_nostat(&b->lock, "buffer");
+    acquire(&bcache.glock);
+    for(i = 1; i < GPP; i++){
+      g[i].next = bcache.free;
+      bcache.free = &g[i];
+    }
+    release(&bcache.glock);
+  }
+  if(g == 0 || (pg = kalloc()) == 0){
+    acquire(&bcache.glock);
+    if(g){
+      g->next = bcache.free;
+      bcache.free = g;
+    }
+    bcache.nbuf -= BPG;
+    release(&bcache.glock);
+    return 0;
+  }
+
+  for(i = 0; i < BPG; i++){
+    b = &g->buf[i];
+    b->data = (uchar*)pg + i*BSIZE;
+    b->dev = 0;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->lastuse = 0;
+  }
+  acquire(&bcache.glock);
+  g->next = bcache.groups;
+  bcache.groups = g;
+  release(&bcache.glock);
+
+  acquire(&bcache.lock);
+  for(i = 0; i < BPG; i++)
+    blink(&bcache.spare, &g->buf[i]);
+  release(&bcache.lock);
+  return 1;
+}
+
+// Try to take all of g's buffers out of the cache, which
+// they must all be unused for.  Caller holds bcache.glock.
+static int
+bdetach(struct bgroup *g)
+{
+  struct bucket *bks[BPG], *bk, *t;
+  struct buf *b;
+  int i, j, n, ok;
+
+  // lock the buckets that g's buffers are in, in address order.
+  n = 0;
+  for(b = g->buf; b < g->buf + BPG; b++){
+    if(b->dev == 0)
+      continue;
+    bk = bbucket(b->dev, b->blockno);
+    for(j = 0; j < n && bks[j] != bk; j++)
+      ;
+    if(j < n)
+      continue;
+    for(j = n++; j > 0 && bks[j-1] > bk; j--)
+      bks[j] = bks[j-1];
+    bks[j] = bk;
+  }
+  for(i = 0; i < n; i++)
+    acquire(&bks[i]->lock);
+  acquire(&bcache.lock);
+
+  // buffers may have moved since they were looked at.
+  // A buffer with dev 0 and refcnt 0 is a spare.
+  ok = 1;
+  for(b = g->buf; b < g->buf + BPG; b++){
+    if(b->refcnt != 0){
+      ok = 0;
+      break;
+    }
+    if(b->dev == 0)
+      continue;
+    t = bbucket(b->dev, b->blockno);
+    for(j = 0; j < n && bks[j] != t; j++)
+      ;
+    if(j == n){
+      ok = 0;
+      break;
+    }
+  }
+  if(ok){
+    for(b = g->buf; b < g->buf + BPG; b++){
+      bunlink(b);
+      b->dev = 0;
+    }
+  }
+
+  release(&bcache.lock);
+  for(i = n - 1; i >= 0; i--)
+    release(&bks[i]->lock);
+  return ok;
+}
+
+// Free up to npage pages of unused buffers, keeping at
+// least NBUF buffers.  Called by kalloc() when memory runs
+// out, so must not allocate.  Returns the number freed.
+int
+bshrink(int npage)
+{
+  struct bgroup *g, **pp;
+  int n;
+
+  n = 0;
+  acquire(&bcache.glock);
+  pp = &bcache.groups;
+  while((g = *pp) != 0 && n < npage && bcache.nbuf - BPG >= NBUF){
+    if(!bdetach(g)){
+      pp = &g->next;
+      continue;
+    }
+    *pp = g->next;
+    kfree(g->buf[0].data);
+    g->next = bcache.free;
+    bcache.free = g;
+    bcache.nbuf -= BPG;
+    n++;
+  }
+  release(&bcache.glock);
+  return n;
+}
+
 void
 binit(void)
+{
+  struct bucket *bk;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  initlock(&bcache.lock, "bcache.spare");
+  initlock(&bcache.glock, "bcache.group");
+  bcache.spare.prev = &bcache.spare;
+  bcache.spare.next = &bcache.spare;
+
+  bcache.maxbuf = (PHYSTOP - KERNBASE) / BCACHEFRAC / BSIZE;
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+  while(bcache.nbuf < NBUF)
+    if(!bgrow())
+      panic("binit");
+}
+
+// Find the buffer for dev/blockno in bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Find the least recently used unused buffer in bk.
+// Caller must hold bk->lock.
+static struct buf*
+blru(struct bucket *bk)
+{
+  struct buf *b, *lru;
+
+  lru = 0;
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->refcnt == 0 && (lru == 0 || b->lastuse < lru->lastuse))
+      lru = b;
+  return lru;
+}
+
+// Take a spare buffer, or return 0 if there is none.
+// Its refcnt is already 1, so that bshrink() leaves it be.
+static struct buf*
+bspare(void)
+{
+  struct buf *b;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  acquire(&bcache.lock);
+  b = bcache.spare.next;
+  if(b == &bcache.spare){
+    b = 0;
+  } else {
+    bunlink(b);
+    b->refcnt = 1;
   }
+  release(&bcache.lock);
+  return b;
+}
+
+// Give the unused buffer b, which is in bucket bk, to
+// block dev/blockno.  Caller holds bk->lock, which this
+// releases.  Returns b locked.
+static struct buf*
+bassign(struct bucket *bk, struct buf *b, uint dev, uint blockno)
+{
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  __sync_fetch_and_add(&bcache.misses, 1);
+  acquiresleep(&b->lock);
+  return b;
 }
 
+// bget() modes.
+#define BWAIT     0  // panic if there is no free buffer
+#define BTRY      1  // return 0 if there is no free buffer
+#define BPREFETCH 2  // ... or if the block is already cached
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// In mode BTRY, return 0 instead if no buffer is free.  For
+// readahead, mode is BPREFETCH: also return 0 if the block is
+// already cached, so that bget() never sleeps.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int mode)
 {
-  struct buf *b;
+  struct bucket *bk, *vk, *first, *second;
+  struct buf *b, *victim;
+  int i, grow;
 
-  acquire(&bcache.lock);
+  bk = bbucket(dev, blockno);
+  grow = 1;
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  for(;;){
+    acquire(&bk->lock);
+
+    // Is the block already cached?
+    if((b = bfind(bk, dev, blockno)) != 0){
+      if(mode == BPREFETCH){
+        release(&bk->lock);
+        return 0;
+      }
       b->refcnt++;
-      release(&bcache.lock);
+      release(&bk->lock);
+      __sync_fetch_and_add(&bcache.hits, 1);
       acquiresleep(&b->lock);
       return b;
     }
+
+    // Not cached.
+    // Use a spare buffer, or grow the cache and look again,
+    // rather than recycle another block's buffer.
+    if((b = bspare()) != 0){
+      blink(&bk->head, b);
+      return bassign(bk, b, dev, blockno);
+    }
+    if(grow && bcache.nbuf < bcache.maxbuf){
+      release(&bk->lock);
+      grow = bgrow();
+      continue;
+    }
+
+    // Recycle an unused buffer from this bucket if there is one.
+    if((b = blru(bk)) != 0)
+      return bassign(bk, b, dev, blockno);
+    release(&bk->lock);
+
+    // Steal the least recently used unused buffer from
+    // another bucket, looking at one bucket at a time.
+    victim = 0;
+    vk = 0;
+    for(i = 0; i < NBUCKET; i++){
+      if(&bcache.bucket[i] == bk)
+        continue;
+      acquire(&bcache.bucket[i].lock);
+      b = blru(&bcache.bucket[i]);
+      if(b && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        vk = &bcache.bucket[i];
+      }
+      release(&bcache.bucket[i].lock);
+    }
+    if(victim == 0){
+      if(mode != BWAIT)
+        return 0;
+      panic("bget: no buffers");
+    }
+
+    // Lock both buckets, lower index first to avoid deadlock,
+    // and make sure that nobody cached the block or took the
+    // victim in the meantime.  If so, start over.
+    first = bk < vk ? bk : vk;
+    second = bk < vk ? vk : bk;
+    acquire(&first->lock);
+    acquire(&second->lock);
+    if(bfind(bk, dev, blockno) == 0 && victim->refcnt == 0 &&
+       victim->dev != 0 && bbucket(victim->dev, victim->blockno) == vk){
+      bunlink(victim);
+      blink(&bk->head, victim);
+      release(&vk->lock);
+      return bassign(bk, victim, dev, blockno);
+    }
+    release(&second->lock);
+    release(&first->lock);
   }
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Report hit and size statistics, and the acquires and spins
+// of the buffers' locks, which there are too many of for
+// lockstat() to record one by one.
+void
+bstat(struct bcstat *st)
+{
+  struct bgroup *g;
+  struct buf *b;
+
+  st->hits = bcache.hits;
+  st->misses = bcache.misses;
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
+  st->lockn = st->lockts = 0;
+  acquire(&bcache.glock);
+  for(g = bcache.groups; g; g = g->next){
+    for(b = g->buf; b < g->buf + BPG; b++){
+      st->lockn += b->lock.lk.n;
+      st->lockts += b->lock.lk.nts;
     }
   }
-  panic("bget: no buffers");
+  release(&bcache.glock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +463,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, BWAIT);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -111,8 +480,147 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start reading (if b is not yet valid) or writing b
+// without waiting for the disk.  Must be locked, and
+// must stay locked until bwait(b) returns.
+void
+bsubmit(struct buf *b, int write)
+{
+  bsubmitv(&b, 1, write);
+}
+
+// Like bsubmit() for each of the n buffers in bufs, but
+// buffers holding consecutive blocks share one disk request
+// of up to NVEC blocks.  Reads skip buffers that are valid.
+void
+bsubmitv(struct buf **bufs, int n, int write)
+{
+  int i, start;
+
+  start = 0;
+  for(i = 0; i <= n; i++){
+    if(i < n && !holdingsleep(&bufs[i]->lock))
+      panic("bsubmitv");
+    if(i < n && !write && bufs[i]->valid){
+      // flush the run before b, and skip b.
+      if(i > start)
+        virtio_disk_submitv(&bufs[start], i - start, bufs[start]->blockno, write);
+      start = i + 1;
+      continue;
+    }
+    if(i > start && (i == n || i - start == NVEC ||
+                     bufs[i]->dev != bufs[i-1]->dev ||
+                     bufs[i]->blockno != bufs[i-1]->blockno + 1)){
+      virtio_disk_submitv(&bufs[start], i - start, bufs[start]->blockno, write);
+      start = i;
+    }
+  }
+}
+
+// Start writing the n locked buffers in bufs to the n
+// consecutive disk blocks starting at blockno, regardless of
+// their own block numbers; the log uses this to write copies
+// of cached blocks into the log.  Wait with bwait().
+void
+bwriteat(struct buf **bufs, int n, uint blockno)
+{
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > NVEC)
+      m = NVEC;
+    for(int j = i; j < i + m; j++)
+      if(!holdingsleep(&bufs[j]->lock))
+        panic("bwriteat");
+    virtio_disk_submitv(&bufs[i], m, blockno + i, 1);
+  }
+}
+
+// Return locked bufs with the contents of up to n blocks
+// starting at blockno, reading the uncached ones from
+// disk with as few requests as possible, and return how
+// many.  Only the first block is sure to get a buffer, as
+// with bread(); the rest are taken only while buffers are
+// free, so that readers holding up to NVEC buffers each
+// cannot use up the cache between them.
+// The caller must release each of them.
+int
+breadn(uint dev, uint blockno, int n, struct buf **bufs)
+{
+  int i;
+
+  bufs[0] = bget(dev, blockno, BWAIT);
+  for(i = 1; i < n; i++)
+    if((bufs[i] = bget(dev, blockno + i, BTRY)) == 0)
+      break;
+  n = i;
+  bsubmitv(bufs, n, 0);
+  for(i = 0; i < n; i++)
+    bwait(bufs[i]);
+  return n;
+}
+
+// Called by the disk interrupt when a readahead finishes.
+static void
+bprefetched(struct buf *b)
+{
+  b->valid = 1;
+  brelse_async(b);
+}
+
+// Start reading the n blocks from blockno on into the cache,
+// without waiting for the disk.  Blocks that are cached, or
+// for which no buffer is free, are skipped.  The buffers
+// stay locked until their reads finish, so a bread() of one
+// of them in the meantime waits for the read.
+void
+bprefetch(uint dev, uint blockno, int n)
+{
+  struct buf *b, *bufs[NVEC];
+  int i, k;
+
+  k = 0;
+  for(i = 0; i < n; i++){
+    if((b = bget(dev, blockno + i, BPREFETCH)) != 0){
+      b->done = bprefetched;
+      bufs[k++] = b;
+    }
+    if(k > 0 && (k == NVEC || i == n - 1)){
+      bsubmitv(bufs, k, 0);
+      k = 0;
+    }
+  }
+}
+
+// Wait for the disk operation started by bsubmit(b).
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  virtio_disk_wait(b);
+  b->valid = 1;
+}
+
+// Drop a reference to an unlocked buffer.
+// Record when it was last used, for LRU recycling.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +628,33 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Release a buffer whose asynchronous write has finished,
+// on behalf of the process that locked it.  For b->done
+// callbacks, which run in the disk interrupt handler.
+void
+brelse_async(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
@@ -5,8 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when refcnt last dropped to 0, for LRU
+  void (*done)(struct buf*); // if set, called by disk interrupt when I/O finishes
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, in a page shared with other bufs
 };
 
@@ -1,19 +1,31 @@
+struct bcstat;
 struct buf;
 struct context;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct schedstat;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vmseg;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            brelse_async(struct buf*);
 void            bwrite(struct buf*);
+void            bsubmit(struct buf*, int);
+void            bsubmitv(struct buf**, int, int);
+void            bwriteat(struct buf**, int, uint);
+int             breadn(uint, uint, int, struct buf**);
+void            bprefetch(uint, uint, int);
+int             bshrink(int);
+void            bstat(struct bcstat*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -24,6 +36,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execfault(struct proc*, struct vmseg*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -38,8 +51,12 @@ int             filewrite(struct file*, uint64, int n);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dcache_enter(struct inode*, char*, uint, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            idenywrite(struct inode*);
+void            iallowwrite(struct inode*);
+int             iwritedenied(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -50,6 +67,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -63,12 +81,15 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kaddref(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_sync(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -86,6 +107,7 @@ int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
+int             kthread(char*, void (*)(void));
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -100,9 +122,14 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
-int             wait(uint64);
+int             waitpid(int, uint64);
 void            wakeup(void*);
 void            yield(void);
+void            schedtick(void);
+int             nice(int);
+int             setaffinity(int, uint64);
+uint64          getaffinity(int);
+int             cpustat(int, struct schedstat*);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -114,7 +141,12 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+int             tryacquire(struct spinlock*);
+void            lockinit(void);
+void            initlock_nostat(struct spinlock*, char*);
+void            freelock(struct spinlock*);
 void            release(struct spinlock*);
+int             lockstat(char*);
 void            push_off(void);
 void            pop_off(void);
 
@@ -123,6 +155,7 @@ void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initsleeplock_nostat(struct sleeplock*, char*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -147,6 +180,8 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+int             sleepuntil(uint64);
+void            timeridle(int);
 
 // uart.c
 void            uartinit(void);
@@ -165,6 +200,9 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void            uvmprefault(uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -183,6 +221,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_submitv(struct buf **, int, uint, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
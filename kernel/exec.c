@@ -6,8 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 int flags2perm(int flags)
 {
@@ -19,15 +20,20 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Replace the current process's image with the program at path.
+// The ELF segments are not read here: exec() records them in
+// p->seg[] and keeps a reference to the program's inode, and
+// vmfault() loads each page on first touch.
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0, *oldexecip;
   struct proghdr ph;
+  struct vmseg seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +55,7 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments; vmfault() loads them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,15 +67,27 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr + ph.memsz >= TRAPFRAME)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(nseg >= NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].off = ph.off;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  idenywrite(ip);
+  iunlock(ip);
   end_op();
+  execip = ip;
   ip = 0;
 
   p = myproc();
@@ -122,11 +140,21 @@ exec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldexecip = p->execip;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->execip = execip;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexecip){
+    iallowwrite(oldexecip);
+    begin_op();
+    iput(oldexecip);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +165,59 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(execip){
+    iallowwrite(execip);
+    begin_op();
+    iput(execip);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
+// Map the page of segment sg that contains va, reading its
+// contents from the program file p->execip. Called by
+// vmfault() the first time a program page is touched.
+// The caller of a copy into user memory that runs with a
+// spinlock or a buffer held must fault the pages in first,
+// with uvmprefault(), since this reads the disk.
 // Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+execfault(struct proc *p, struct vmseg *sg, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
+  struct inode *ip = p->execip;
+  uint64 off;
+  uint n;
+  int locked, r;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  off = va - sg->va;
+  if(off < sg->filesz){
+    if(sg->filesz - off < PGSIZE)
+      n = sg->filesz - off;
     else
       n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+    // the process may be reading its own program file,
+    // in which case it already holds ip->lock.
+    locked = holdingsleep(&ip->lock);
+    if(!locked)
+      ilock(ip);
+    r = readi(ip, 0, (uint64)mem, sg->off + off, n);
+    if(!locked)
+      iunlock(ip);
+    if(r != n){
+      kfree(mem);
       return -1;
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, sg->perm|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
   }
-  
   return 0;
 }
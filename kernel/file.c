@@ -101,6 +101,38 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+#define RAMIN 4         // first readahead window, in blocks
+#define RAMAX (2*NVEC)  // largest readahead window
+
+// Read ahead of a read of n bytes at f->off.  A read that
+// starts where the last one ended is sequential, and doubles
+// the window, up to RAMAX blocks; any other read closes it.
+// Once the reader is within half a window of the blocks read
+// ahead so far, start reading the next ones, up to a window
+// past the end of this read.  Caller must hold f->ip->lock.
+static void
+readahead(struct file *f, int n)
+{
+  uint end;
+
+  if(f->off != f->raend || n <= 0){
+    f->rawin = 0;
+    f->ranext = 0;
+    return;
+  }
+  f->rawin = f->rawin == 0 ? RAMIN : 2*f->rawin;
+  if(f->rawin > RAMAX)
+    f->rawin = RAMAX;
+
+  end = (f->off + n + BSIZE - 1) / BSIZE;  // first block after this read
+  if(f->ranext < end)
+    f->ranext = end;
+  if(f->ranext < end + f->rawin/2){
+    ireadahead(f->ip, f->ranext, end + f->rawin - f->ranext);
+    f->ranext = end + f->rawin;
+  }
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -111,6 +143,10 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // pipes and the console copy out with a spinlock held,
+  // and readi() with a buffer locked.
+  uvmprefault(addr, n);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -119,8 +155,10 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    readahead(f, n);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    f->raend = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -139,6 +177,8 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  uvmprefault(addr, n);
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -148,11 +188,11 @@ filewrite(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, up to 3 levels of indirect blocks, allocation
+    // blocks, and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((MAXOPBLOCKS-1-3-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -161,7 +201,8 @@ filewrite(struct file *f, uint64 addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      r = -1;
+      if (!iwritedenied(f->ip) && (r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
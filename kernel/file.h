@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint raend;        // FD_INODE: where the last read ended
+  uint ranext;       // FD_INODE: first block not yet read ahead
+  uint rawin;        // FD_INODE: readahead window, in blocks
   short major;       // FD_DEVICE
 };
 
@@ -18,15 +21,20 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // itable hash chain
+  struct inode *prev;   // itable LRU list, if ref == 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint goal;          // block after the last one allocated, for locality
+  int nexec;          // processes running it; see idenywrite()
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
 };
 
 // map major device number to device functions.
@@ -13,6 +13,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "stat.h"
 #include "spinlock.h"
 #include "proc.h"
@@ -26,6 +27,10 @@
 // only one device
 struct superblock sb; 
 
+static void binit_count(int);
+static void dcacheinit(void);
+static void dcache_purge(uint, uint);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +49,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  binit_count(dev);
 }
 
 // Zero a block.
@@ -59,30 +65,101 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// bfree_count[] summarizes the free bitmap in memory: the
+// number of free blocks described by each bitmap block, so
+// that balloc() skips full bitmap blocks without reading
+// them.  A count only changes while its bitmap block's buffer
+// is locked; readers use it as a hint.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+#define NBITMAP (FSSIZE/BPB + 1)
+
+static uint bfree_count[NBITMAP];
+static uint brotor;  // where to look when there is no goal
+
+// Count the free blocks described by each bitmap block.
+static void
+binit_count(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi, n;
 
-  bp = 0;
+  if(sb.size > NBITMAP*BPB)
+    panic("binit_count: file system too big");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
-    }
+    n = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        n++;
+    bfree_count[b/BPB] = n;
     brelse(bp);
   }
+  brotor = sb.size - sb.nblocks;  // first data block
+}
+
+// Allocate the first free block at or after bit from of the
+// bitmap block for blocks b..b+BPB-1, looking at 64 bits at
+// a time.  Returns 0 if there is none.
+static uint
+bscan(uint dev, uint b, uint from)
+{
+  struct buf *bp;
+  uint64 *w, x;
+  uint wi, bi;
+
+  bp = bread(dev, BBLOCK(b, sb));
+  w = (uint64*)bp->data;
+  for(wi = from / 64; wi < BPB / 64 && b + wi*64 < sb.size; wi++){
+    x = w[wi];
+    if(wi == from / 64)
+      x |= (1UL << (from % 64)) - 1;  // ignore bits before from
+    if(x == ~0UL)
+      continue;
+    for(bi = 0; x & (1UL << bi); bi++)
+      ;
+    bi += wi * 64;
+    if(b + bi >= sb.size)
+      break;
+    w[wi] |= 1UL << (bi % 64);  // Mark block in use.
+    bfree_count[b/BPB]--;
+    log_write(bp);
+    brelse(bp);
+    return b + bi;
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block: goal if it is free, else
+// the nearest free block after it, so that a file's blocks
+// end up next to each other.  A goal of 0 means no
+// preference.  Bitmap blocks with no free blocks are
+// skipped without reading them.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, start, i, nb, addr;
+
+  if(goal == 0 || goal >= sb.size)
+    goal = brotor;
+  nb = (sb.size + BPB - 1) / BPB;
+  start = goal / BPB;
+
+  // the goal's bitmap block from the goal on, then the
+  // others, then the goal's block again from its start.
+  for(i = 0; i <= nb; i++){
+    b = ((start + i) % nb) * BPB;
+    if(bfree_count[b/BPB] == 0)
+      continue;
+    addr = bscan(dev, b, i == 0 ? goal % BPB : 0);
+    if(addr){
+      brotor = addr + 1;
+      bzero(dev, addr);
+      return addr;
+    }
+  }
   printf("balloc: out of blocks\n");
   return 0;
 }
@@ -100,6 +177,7 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bfree_count[b/BPB]++;
   log_write(bp);
   brelse(bp);
 }
@@ -134,13 +212,17 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref.  A free entry keeps its inode until
+//   iget() recycles it for another, least recently used
+//   entries first, so iget() of a recently used inode
+//   usually finds it still valid.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode and iget() when it
+//   recycles the entry.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -167,26 +249,97 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those
+// fields, or the hash chains and the list of free entries.
+//
+// The table is sized at boot: at least NINODE entries, or
+// one page of entries for every IPAGEFRAC pages of memory.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 509
+#define IHASH(dev, inum) (((uint)(dev)*31 + (uint)(inum)) % NIHASH)
+#define IPAGEFRAC 1024
+#define IPP (PGSIZE / sizeof(struct inode))  // entries per page
+
+extern char end[];  // first address after kernel.
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  // Free entries, most recently used first.
+  // lru.next is the most recent, lru.prev the least.
+  struct inode lru;
+  int n;
 } itable;
 
+// Put the free entry ip on the LRU list: at the front if it
+// holds a valid inode, else at the back to be recycled first.
+// Caller must hold itable.lock.
+static void
+ilru_put(struct inode *ip)
+{
+  struct inode *at;
+
+  at = ip->valid ? &itable.lru : itable.lru.prev;
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+// Take ip off the LRU list.
+// Caller must hold itable.lock.
+static void
+ilru_take(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Remove ip from its hash chain, if it is on one.
+// Caller must hold itable.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct inode *ip;
+  uint64 npage;
+  char *pg;
+  int i;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.lru.next = itable.lru.prev = &itable.lru;
+
+  npage = (PHYSTOP - (uint64)end) / PGSIZE / IPAGEFRAC;
+  if(npage * IPP < NINODE)
+    npage = (NINODE + IPP - 1) / IPP;
+  for(; npage > 0; npage--){
+    if((pg = kalloc()) == 0)
+      panic("iinit");
+    memset(pg, 0, PGSIZE);
+    for(i = 0; i < IPP; i++){
+      ip = (struct inode*)pg + i;
+      initsleeplock(&ip->lock, "inode");
+      ilru_put(ip);
+      itable.n++;
+    }
   }
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +399,37 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  h = IHASH(dev, inum);
+  for(ip = itable.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilru_take(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry.
+  ip = itable.lru.prev;
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  ilru_take(ip);
+  if(ip->inum != 0)
+    iunhash(ip);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->goal = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +446,31 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count a process whose program is ip.  execfault() reads
+// program pages from ip as they are first touched, so while
+// any process is counted, filewrite() and open(O_TRUNC)
+// refuse to change ip, like ETXTBSY.  Callers that count
+// a new program hold ip's lock, as do the checks.
+void
+idenywrite(struct inode *ip)
+{
+  __atomic_add_fetch(&ip->nexec, 1, __ATOMIC_RELAXED);
+}
+
+// Stop counting a process whose program was ip.
+void
+iallowwrite(struct inode *ip)
+{
+  __atomic_sub_fetch(&ip->nexec, 1, __ATOMIC_RELAXED);
+}
+
+// Is ip some process's program?
+int
+iwritedenied(struct inode *ip)
+{
+  return __atomic_load_n(&ip->nexec, __ATOMIC_RELAXED) > 0;
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -347,6 +531,8 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -357,7 +543,8 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    ilru_put(ip);
   release(&itable.lock);
 }
 
@@ -374,7 +561,24 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The next NDINDIRECT
+// are listed in the blocks listed in block ip->addrs[NDIRECT+1],
+// and the NTINDIRECT after those one level further down from
+// ip->addrs[NDIRECT+2].
+
+static uint emap(struct inode*, uint, uint*);
+
+// Allocate a block for inode ip, next to the last one it got.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr;
+
+  addr = balloc(ip->dev, ip->goal);
+  if(addr)
+    ip->goal = addr + 1;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,12 +586,16 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, n;
   struct buf *bp;
+  int level;
+
+  if(sb.features & FS_EXTENTS)
+    return emap(ip, bn, &n);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -396,28 +604,207 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+  // Find the indirect tree that holds bn: ip->addrs[NDIRECT]
+  // is singly indirect, the next doubly, the last triply.
+  // n is the number of blocks the tree covers.
+  for(level = 1, n = NINDIRECT; level <= 3 && bn >= n; level++, n *= NINDIRECT)
+    bn -= n;
+  if(level > 3)
+    panic("bmap: out of range");
+
+  // Load the top indirect block, allocating if necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+    addr = iballoc(ip);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level-1] = addr;
+  }
+
+  // Walk down one indirect block per level, allocating
+  // missing blocks on the way.
+  for(; level > 0; level--){
+    n /= NINDIRECT;  // blocks covered by each entry
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = a[bn / n]) == 0){
+      addr = iballoc(ip);
       if(addr){
-        a[bn] = addr;
+        a[bn / n] = addr;
         log_write(bp);
       }
     }
     brelse(bp);
+    if(addr == 0)
+      return 0;
+    bn %= n;
+  }
+  return addr;
+}
+
+// Extents.
+//
+// On a file system with FS_EXTENTS, a file's blocks are
+// described by extents (see fs.h).  Files only grow at the
+// end, so a new block either extends the last extent, when
+// balloc() can hand out the block right after it, or starts
+// a new extent.
+
+// Return the disk block address of the nth block in extent-
+// mapped inode ip, and set *np to the number of blocks of its
+// extent from there on.  If bn is the block just past the end
+// of the file, allocate it.  Returns 0 if out of disk space
+// or out of extents.
+static uint
+emap(struct inode *ip, uint bn, uint *np)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint off, addr, ob;
+  int i;
+
+  bp = 0;
+  last = 0;
+  off = 0;  // first file block of extent i
+  e = (struct extent*)ip->addrs;
+  for(i = 0; i < NEXTENT + NXEXTENT; i++, e++){
+    if(i == NEXTENT){
+      if(ip->addrs[2*NEXTENT] == 0)
+        break;
+      bp = bread(ip->dev, ip->addrs[2*NEXTENT]);
+      e = (struct extent*)bp->data;
+    }
+    if(e->len == 0)
+      break;
+    if(bn < off + e->len){
+      addr = e->start + (bn - off);
+      *np = e->len - (bn - off);
+      if(bp)
+        brelse(bp);
+      return addr;
+    }
+    off += e->len;
+    last = e;
+  }
+
+  // bn is not mapped, so it must be the next block of the file.
+  if(bn != off)
+    panic("emap");
+  *np = 1;
+
+  if(last)
+    ip->goal = last->start + last->len;
+  addr = iballoc(ip);
+  if(addr == 0)
+    goto out;
+  if(last && addr == last->start + last->len){
+    // the run continues.
+    last->len++;
+    if(i > NEXTENT)
+      log_write(bp);
+    goto out;
+  }
+
+  // start a new extent at index i.
+  if(i == NEXTENT + NXEXTENT){
+    bfree(ip->dev, addr);
+    addr = 0;
+    goto out;
+  }
+  if(i == NEXTENT && bp == 0){
+    if((ob = balloc(ip->dev, 0)) == 0){
+      bfree(ip->dev, addr);
+      addr = 0;
+      goto out;
+    }
+    ip->addrs[2*NEXTENT] = ob;
+    bp = bread(ip->dev, ob);
+    e = (struct extent*)bp->data;
+  }
+  e->start = addr;
+  e->len = 1;
+  if(bp)
+    log_write(bp);
+
+ out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Free all blocks of extent-mapped inode ip.
+static void
+etrunc(struct inode *ip)
+{
+  struct extent *e;
+  struct buf *bp;
+  uint j;
+  int i;
+
+  bp = 0;
+  e = (struct extent*)ip->addrs;
+  for(i = 0; i < NEXTENT + NXEXTENT; i++, e++){
+    if(i == NEXTENT){
+      if(ip->addrs[2*NEXTENT] == 0)
+        break;
+      bp = bread(ip->dev, ip->addrs[2*NEXTENT]);
+      e = (struct extent*)bp->data;
+    }
+    if(e->len == 0)
+      break;
+    for(j = 0; j < e->len; j++)
+      bfree(ip->dev, e->start + j);
+  }
+  if(bp){
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[2*NEXTENT]);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+}
+
+// Like bmap(), but also set *np to the number of blocks,
+// at most max, that are consecutive on disk from bn on.
+// Only for blocks that exist; never allocates.
+static uint
+bmapn(struct inode *ip, uint bn, uint max, uint *np)
+{
+  uint addr, n;
+
+  if(sb.features & FS_EXTENTS){
+    addr = emap(ip, bn, &n);
+    *np = min(n, max);
     return addr;
   }
+  addr = bmap(ip, bn);
+  for(n = 1; n < max; n++)
+    if(bmap(ip, bn + n) != addr + n)
+      break;
+  *np = n;
+  return addr;
+}
+
+// Free the indirect block addr and the blocks it points to;
+// level is 1 for a singly-indirect block, 2 for doubly, 3 for
+// triply.  Only bitmap blocks are written, so freeing even a
+// huge file touches at most the file system's bitmap blocks.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      ifree(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +812,14 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(sb.features & FS_EXTENTS){
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,16 +828,11 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      ifree(ip->dev, ip->addrs[NDIRECT+i], i+1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
@@ -471,30 +858,64 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, addr, bn, last, k;
+  struct buf *bp[NVEC];
+  int i, err;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n == 0)
+    return 0;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+  last = (off + n - 1) / BSIZE;
+  err = 0;
+  for(tot=0; tot<n; ){
+    // read the next blocks that are consecutive on
+    // disk, up to NVEC of them, with one request.
+    bn = off/BSIZE;
+    addr = bmapn(ip, bn, min(NVEC, last - bn + 1), &k);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
-      tot = -1;
-      break;
+    k = breadn(ip->dev, addr, k, bp);
+    for(i = 0; i < k; i++){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(!err && either_copyout(user_dst, dst, bp[i]->data + (off % BSIZE), m) == -1)
+        err = 1;
+      brelse(bp[i]);
+      tot += m;
+      off += m;
+      dst += m;
     }
-    brelse(bp);
+    if(err)
+      return -1;
   }
   return tot;
 }
 
+// Start reading the n blocks of ip from block bn on into the
+// buffer cache, without waiting, stopping at the end of the file.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint bn, uint n)
+{
+  uint addr, end, k;
+
+  end = (ip->size + BSIZE - 1) / BSIZE;
+  if(bn >= end)
+    return;
+  n = min(n, end - bn);
+  while(n > 0){
+    addr = bmapn(ip, bn, min(NVEC, n), &k);
+    if(addr == 0)
+      break;
+    bprefetch(ip->dev, addr, k);
+    bn += k;
+    n -= k;
+  }
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -546,6 +967,555 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// Caches the results of directory lookups, keyed by
+// (dev, directory inum, name), including negative entries for
+// names that a directory does not contain, so that repeated
+// lookups need not read directory blocks.  Entries are added
+// by dirlookup() and dirlink() and updated by sys_unlink(),
+// all with the directory locked; iput() drops the entries of
+// a directory when it is freed.  namex() looks names up
+// without locking the directory.
+
+#define NDCACHE 256
+#define NDHASH 67
+
+struct dentry {
+  uint dev;
+  uint dir;             // inum of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if the directory has no such name
+  uint off;             // byte offset of the dirent, if inum != 0
+  struct dentry *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+  int hand;             // next entry to recycle
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for name in dir.
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *de;
+
+  for(de = dcache.hash[dhash(dev, dir, name)]; de; de = de->next)
+    if(de->dev == dev && de->dir == dir && namecmp(de->name, name) == 0)
+      return de;
+  return 0;
+}
+
+// Remove de from its hash chain.
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *de)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(de->dev, de->dir, de->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == de){
+      *pp = de->next;
+      break;
+    }
+  }
+  de->dir = 0;
+}
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// Look up name in directory dp.  If the cache knows the
+// answer, return 1 and set *ipp to the named inode, with a
+// new reference, or to 0 if dp has no such name, and set *poff
+// if poff != 0.  Otherwise return 0.  The caller need not
+// hold dp's lock: iget() is done under dcache.lock, so a
+// concurrent unlink cannot free the inode first.
+static int
+dcache_lookup(struct inode *dp, char *name, struct inode **ipp, uint *poff)
+{
+  struct dentry *de;
+
+  acquire(&dcache.lock);
+  if((de = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *ipp = de->inum ? iget(dp->dev, de->inum) : 0;
+  if(poff)
+    *poff = de->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that directory dp maps name to inum (0 for no such
+// name), in the dirent at offset off.
+// Caller must hold dp's lock.
+void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *de;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((de = dfind(dp->dev, dp->inum, name)) == 0){
+    de = &dcache.ent[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDCACHE;
+    if(de->dir)
+      dunhash(de);
+    de->dev = dp->dev;
+    de->dir = dp->inum;
+    strncpy(de->name, name, DIRSIZ);
+    h = dhash(de->dev, de->dir, de->name);
+    de->next = dcache.hash[h];
+    dcache.hash[h] = de;
+  }
+  de->inum = inum;
+  de->off = off;
+  release(&dcache.lock);
+}
+
+// Forget all entries of directory dir, which is being freed.
+static void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *de;
+
+  acquire(&dcache.lock);
+  for(de = dcache.ent; de < dcache.ent + NDCACHE; de++)
+    if(de->dir == dir && de->dev == dev)
+      dunhash(de);
+  release(&dcache.lock);
+}
+
+// Directory index; see fs.h for the layout.  All of these
+// functions require the caller to hold dp's lock, and run
+// within the caller's transaction.
+
+// FNV-1a hash of a name.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Read block bn, which must exist, of directory dp.
+static struct buf*
+dxread(struct inode *dp, uint bn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, bn)) == 0)
+    panic("dxread");
+  return bread(dp->dev, addr);
+}
+
+// The header of index block bp, which is block bn of its directory.
+static struct dxhead*
+dxhdr(struct buf *bp, uint bn)
+{
+  if(bn == 0)
+    return (struct dxhead*)(bp->data + 2*sizeof(struct dirent));
+  return (struct dxhead*)bp->data;
+}
+
+// Index of the last of the n entries e[] whose hash is <= h.
+// e[0].hash is always 0.
+static int
+dxsearch(struct dxentry *e, int n, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Is hd a sane header for index block bn of directory dp?
+// What is on disk is not trusted: a bad index must not send
+// dxwalk() to a block the directory does not have.
+static int
+dxvalid(struct inode *dp, struct dxhead *hd, uint bn)
+{
+  struct dxentry *e;
+  uint i;
+
+  if(hd->magic != DXMAGIC || hd->inum != 0)
+    return 0;
+  if(hd->depth > (bn == 0 ? 1 : 0))
+    return 0;
+  if(hd->count < 1 || hd->count > (bn == 0 ? DXROOT : DXNODE))
+    return 0;
+  e = (struct dxentry*)(hd + 1);
+  for(i = 0; i < hd->count; i++){
+    if(e[i].inum != 0 || e[i].block == 0 || e[i].block >= dp->size / BSIZE)
+      return 0;
+  }
+  return 1;
+}
+
+// Does directory dp have an index?
+static int
+dxindexed(struct inode *dp)
+{
+  struct buf *bp;
+  int r;
+
+  if(!(sb.features & FS_DIRINDEX) || dp->size < 2*BSIZE)
+    return 0;
+  bp = dxread(dp, 0);
+  r = dxvalid(dp, dxhdr(bp, 0), 0);
+  brelse(bp);
+  return r;
+}
+
+// Follow the index of directory dp to the leaf block for hash h,
+// setting *node to the interior block on the way, or 0 if the
+// leaf hangs off the root.  Returns the leaf's block number, or
+// 0 if the interior block is bad.
+static uint
+dxwalk(struct inode *dp, uint h, uint *node)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint bn, depth;
+
+  bp = dxread(dp, 0);
+  hd = dxhdr(bp, 0);
+  e = (struct dxentry*)(hd + 1);
+  bn = e[dxsearch(e, hd->count, h)].block;
+  depth = hd->depth;
+  brelse(bp);
+
+  *node = 0;
+  if(depth > 0){
+    *node = bn;
+    bp = dxread(dp, bn);
+    hd = dxhdr(bp, bn);
+    e = (struct dxentry*)(hd + 1);
+    if(dxvalid(dp, hd, bn))
+      bn = e[dxsearch(e, hd->count, h)].block;
+    else
+      bn = 0;
+    brelse(bp);
+  }
+  return bn;
+}
+
+// Look name up in directory dp through its index.  Returns -1
+// if dp has no index, 0 if name is not there, and 1 if it is,
+// setting *pinum and *poff.  "." and ".." are not indexed.
+static int
+dxlookup(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint bn, node;
+  int i;
+
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    return -1;
+  if(!dxindexed(dp))
+    return -1;
+  if((bn = dxwalk(dp, dxhash(name), &node)) == 0)
+    return -1;
+  bp = dxread(dp, bn);
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      *pinum = de[i].inum;
+      *poff = bn*BSIZE + i*sizeof(*de);
+      brelse(bp);
+      return 1;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Append a block to directory dp.  Returns its block number
+// within the directory, or -1 if the disk is full.
+static int
+dxgrow(struct inode *dp)
+{
+  uint bn;
+
+  bn = dp->size / BSIZE;
+  if(bn >= MAXFILE || bmap(dp, bn) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bn;
+}
+
+// Insert (h, bn) into index block node, which has room.
+static void
+dxinsert(struct inode *dp, uint node, uint h, uint bn)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  int i;
+
+  bp = dxread(dp, node);
+  hd = dxhdr(bp, node);
+  e = (struct dxentry*)(hd + 1);
+  i = dxsearch(e, hd->count, h) + 1;
+  memmove(&e[i+1], &e[i], (hd->count - i) * sizeof(*e));
+  memset(&e[i], 0, sizeof(*e));
+  e[i].hash = h;
+  e[i].block = bn;
+  hd->count++;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Index directory dp, whose single block is full: move all
+// but "." and ".." to a new leaf and put the index in block 0.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *rb, *lb;
+  struct dxhead *hd;
+  struct dxentry *e;
+  int bn;
+
+  if((bn = dxgrow(dp)) < 0)
+    return -1;
+  rb = dxread(dp, 0);
+  lb = dxread(dp, bn);
+  memset(lb->data, 0, BSIZE);
+  memmove(lb->data, rb->data + 2*sizeof(struct dirent), BSIZE - 2*sizeof(struct dirent));
+  memset(rb->data + 2*sizeof(struct dirent), 0, BSIZE - 2*sizeof(struct dirent));
+  hd = dxhdr(rb, 0);
+  hd->magic = DXMAGIC;
+  hd->count = 1;
+  e = (struct dxentry*)(hd + 1);
+  e[0].block = bn;
+  log_write(lb);
+  log_write(rb);
+  brelse(lb);
+  brelse(rb);
+
+  // names have moved.
+  dcache_purge(dp->dev, dp->inum);
+  return 0;
+}
+
+// The root index block is full and has leaves below it:
+// move its entries to a new interior block.
+static int
+dxdeepen(struct inode *dp)
+{
+  struct buf *rb, *nb;
+  struct dxhead *rh, *nh;
+  struct dxentry *e;
+  int bn;
+
+  if((bn = dxgrow(dp)) < 0)
+    return -1;
+  rb = dxread(dp, 0);
+  nb = dxread(dp, bn);
+  memset(nb->data, 0, BSIZE);
+  rh = dxhdr(rb, 0);
+  nh = dxhdr(nb, bn);
+  nh->magic = DXMAGIC;
+  nh->count = rh->count;
+  memmove(nh + 1, rh + 1, rh->count * sizeof(struct dxentry));
+  memset(rh + 1, 0, rh->count * sizeof(struct dxentry));
+  rh->depth = 1;
+  rh->count = 1;
+  e = (struct dxentry*)(rh + 1);
+  e[0].block = bn;
+  log_write(nb);
+  log_write(rb);
+  brelse(nb);
+  brelse(rb);
+  return 0;
+}
+
+// Split the full interior block node, moving the upper half
+// of its entries to a new block.
+static int
+dxsplitnode(struct inode *dp, uint node)
+{
+  struct buf *bp, *nb;
+  struct dxhead *hd, *nh;
+  struct dxentry *e;
+  uint h;
+  int bn, mid, full;
+
+  bp = dxread(dp, 0);
+  full = dxhdr(bp, 0)->count >= DXROOT;
+  brelse(bp);
+  if(full)
+    return -1;  // directory is as big as it gets
+
+  if((bn = dxgrow(dp)) < 0)
+    return -1;
+  bp = dxread(dp, node);
+  nb = dxread(dp, bn);
+  memset(nb->data, 0, BSIZE);
+  hd = dxhdr(bp, node);
+  nh = dxhdr(nb, bn);
+  e = (struct dxentry*)(hd + 1);
+  mid = hd->count / 2;
+  h = e[mid].hash;
+  nh->magic = DXMAGIC;
+  nh->count = hd->count - mid;
+  memmove(nh + 1, &e[mid], nh->count * sizeof(*e));
+  memset(&e[mid], 0, nh->count * sizeof(*e));
+  hd->count = mid;
+  log_write(nb);
+  log_write(bp);
+  brelse(nb);
+  brelse(bp);
+
+  dxinsert(dp, 0, h, bn);
+  return 0;
+}
+
+// Split the full leaf block leaf, whose parent index block
+// node has room, moving the names in the upper half of its
+// hash range to a new leaf.  Names with equal hashes stay
+// together, since lookups search only one leaf.  Names that
+// stay keep their slots; nothing changes if there is no
+// place to split.
+static int
+dxsplitleaf(struct inode *dp, uint leaf, uint node)
+{
+  struct buf *bp, *nb;
+  struct dirent *de, *nde;
+  uint hv[DPB], h;
+  int bn, i, j, mid;
+
+  // sort the leaf's hashes to find where to split.
+  bp = dxread(dp, leaf);
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    h = dxhash(de[i].name);
+    for(j = i; j > 0 && hv[j-1] > h; j--)
+      hv[j] = hv[j-1];
+    hv[j] = h;
+  }
+  brelse(bp);
+
+  for(mid = DPB/2; mid < DPB && hv[mid] == hv[mid-1]; mid++)
+    ;
+  if(mid == DPB)
+    for(mid = DPB/2; mid > 0 && hv[mid] == hv[mid-1]; mid--)
+      ;
+  if(mid == 0)
+    return -1;  // every name has the same hash
+  h = hv[mid];
+
+  if((bn = dxgrow(dp)) < 0)
+    return -1;
+  bp = dxread(dp, leaf);
+  nb = dxread(dp, bn);
+  de = (struct dirent*)bp->data;
+  nde = (struct dirent*)nb->data;
+  memset(nb->data, 0, BSIZE);
+  for(i = j = 0; i < DPB; i++){
+    if(dxhash(de[i].name) >= h){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(nb);
+  log_write(bp);
+  brelse(nb);
+  brelse(bp);
+
+  dxinsert(dp, node, h, bn);
+
+  // names have moved.
+  dcache_purge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Add (name, inum) to indexed directory dp.  When the leaf for
+// name is full, split it, first making room in the index above
+// it if need be, and try again.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  struct dxhead *hd;
+  uint h, bn, node;
+  int i, full;
+
+  h = dxhash(name);
+  for(;;){
+    if((bn = dxwalk(dp, h, &node)) == 0)
+      return -1;
+    bp = dxread(dp, bn);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        dcache_enter(dp, name, inum, bn*BSIZE + i*sizeof(*de));
+        return 0;
+      }
+    }
+    brelse(bp);
+
+    bp = dxread(dp, node);
+    hd = dxhdr(bp, node);
+    full = hd->count >= (node == 0 ? DXROOT : DXNODE);
+    brelse(bp);
+    if(!full){
+      if(dxsplitleaf(dp, bn, node) < 0)
+        return -1;
+    } else if(node == 0){
+      if(dxdeepen(dp) < 0)
+        return -1;
+    } else {
+      if(dxsplitnode(dp, node) < 0)
+        return -1;
+    }
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -553,25 +1523,39 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct inode *ip;
+  int found;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcache_lookup(dp, name, &ip, poff))
+    return ip;
+
+  if((found = dxlookup(dp, name, &inum, &off)) < 0){
+    found = 0;
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum == 0)
+        continue;
+      if(namecmp(name, de.name) == 0){
+        // entry matches path element
+        inum = de.inum;
+        found = 1;
+        break;
+      }
     }
   }
 
-  return 0;
+  if(!found){
+    dcache_enter(dp, name, 0, 0);
+    return 0;
+  }
+  if(poff)
+    *poff = off;
+  dcache_enter(dp, name, inum, off);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -589,6 +1573,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dxindexed(dp))
+    return dxlink(dp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -597,10 +1584,18 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  if(off == BSIZE && dp->size == BSIZE && (sb.features & FS_DIRINDEX)){
+    // the first block is full: index the directory.
+    if(dxconvert(dp) < 0)
+      return -1;
+    return dxlink(dp, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
@@ -659,6 +1654,14 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(!(nameiparent && *path == '\0') && dcache_lookup(ip, name, &next, 0)){
+      // cached: no need to lock ip or read its blocks.
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
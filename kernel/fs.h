@@ -20,13 +20,34 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint features;     // FS_* feature flags
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define FS_EXTENTS 0x1  // files are mapped by extents
+#define FS_DIRINDEX 0x2 // large directories have a hash index
+
+// addrs[] holds NDIRECT direct block numbers, then the singly,
+// doubly and triply indirect blocks.  File offsets are uints,
+// so the practical size limit is 4GB.
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+
+// On a file system with FS_EXTENTS, addrs[] instead holds
+// NEXTENT extents, runs of consecutive blocks in file order,
+// then the block number of an overflow block with NXEXTENT
+// more.  An extent with len 0 ends the list.
+struct extent {
+  uint start;  // first block of the run
+  uint len;    // number of blocks
+};
+
+#define NEXTENT 6
+#define NXEXTENT (BSIZE / sizeof(struct extent))
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +56,11 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses
 };
 
+#define MAXLINK 32767  // most links to one inode; nlink is a short
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -58,3 +81,35 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+
+// Dirents per block
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// On a file system with FS_DIRINDEX, a directory that outgrows
+// its first block gets a hash index.  Block 0 then holds "." and
+// "..", a dxhead, and up to DXROOT dxentrys sorted by hash; an
+// entry names the block holding the names whose hash is at least
+// its hash and below the next entry's.  If the root's depth is 1,
+// those are interior blocks, each a dxhead and up to DXNODE more
+// dxentrys naming leaves.  Leaves are ordinary dirent blocks.
+// Index slots have inum 0, so readers that treat the directory
+// as a plain sequence of dirents skip them.
+struct dxhead {
+  ushort inum;   // always 0
+  ushort depth;  // root only: levels of interior blocks (0 or 1)
+  uint magic;    // DXMAGIC
+  uint count;    // number of dxentrys that follow
+  uint pad;
+};
+
+struct dxentry {
+  ushort inum;   // always 0
+  ushort pad;
+  uint hash;     // lowest name hash in the child
+  uint block;    // child's block number within the directory
+  uint pad1;
+};
+
+#define DXMAGIC 0x78646968
+#define DXROOT (DPB - 3)
+#define DXNODE (DPB - 1)
@@ -1,6 +1,18 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own free list, so that the common
+// kalloc()/kfree() touches only that CPU's lock and list.
+// Pages move between a CPU's list and a shared pool in
+// batches of KBATCH: a CPU whose list runs dry refills from
+// the pool, and a CPU whose list grows past KHIGH spills a
+// batch back. If the pool is empty too, kalloc() steals a
+// batch from another CPU's list.
+//
+// Pages can be shared copy-on-write by several page tables,
+// so each page has a reference count; kfree() drops one
+// reference and only frees the page when the last one goes.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +21,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH  32          // pages moved per refill, spill, or steal
+#define KHIGH   (2*KBATCH)  // spill when a CPU list holds more than this
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,15 +33,25 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+} __attribute__ ((aligned (64)));
+
+struct kmem kmem[NCPU];  // per-CPU free lists
+struct kmem kpool;       // shared pool, refilled by spills
+
+// reference count of each physical page, updated atomically.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int pageref[PA2REF(PHYSTOP)];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kpool.lock, "kpool");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,48 +60,180 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pageref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Detach up to n pages from the front of km's list.
+// Returns the chain and sets *np to its length.
+// Caller must hold km->lock.
+static struct run *
+takebatch(struct kmem *km, int n, int *np)
+{
+  struct run *head, *r;
+  int i;
+
+  head = km->freelist;
+  if(head == 0){
+    *np = 0;
+    return 0;
+  }
+  r = head;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  km->freelist = r->next;
+  km->nfree -= i;
+  r->next = 0;
+  *np = i;
+  return head;
+}
+
+// Prepend a chain of n pages to km's list.
+// Caller must hold km->lock.
+static void
+putbatch(struct kmem *km, struct run *head, int n)
+{
+  struct run *r;
+
+  if(head == 0)
+    return;
+  for(r = head; r->next; r = r->next)
+    ;
+  r->next = km->freelist;
+  km->freelist = head;
+  km->nfree += n;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference is dropped.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch;
+  struct kmem *km;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  pop_off();
+
+  batch = 0;
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  if(km->nfree > KHIGH)
+    batch = takebatch(km, KBATCH, &n);
+  release(&km->lock);
+
+  if(batch){
+    acquire(&kpool.lock);
+    putbatch(&kpool, batch, n);
+    release(&kpool.lock);
+  }
+}
+
+// Refill km, which belongs to the calling CPU, with a batch
+// from the shared pool or, failing that, from another CPU.
+// Returns one page of the batch, or 0 if there is no free memory.
+static struct run *
+refill(struct kmem *km)
+{
+  struct run *r;
+  int i, n;
+
+  acquire(&kpool.lock);
+  r = takebatch(&kpool, KBATCH, &n);
+  release(&kpool.lock);
+
+  for(i = 0; r == 0 && i < NCPU; i++){
+    if(&kmem[i] == km || kmem[i].freelist == 0)
+      continue;
+    acquire(&kmem[i].lock);
+    r = takebatch(&kmem[i], KBATCH, &n);
+    release(&kmem[i].lock);
+  }
+
+  if(r == 0)
+    return 0;
+
+  if(n > 1){
+    acquire(&km->lock);
+    putbatch(km, r->next, n - 1);
+    release(&km->lock);
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, the buffer cache gives some back.
 void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+
+  push_off();
+  km = &kmem[cpuid()];
+  pop_off();
+
+  for(;;){
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+    }
+    release(&km->lock);
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    if(r == 0)
+      r = refill(km);
+    if(r || bshrink(KBATCH) == 0)
+      break;
+  }
 
-  if(r)
+  if(r){
+    pageref[PA2REF(r)] = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
   return (void*)r;
 }
+
+// Add a reference to an allocated page, for a
+// page table that shares it copy-on-write.
+void
+kaddref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kaddref");
+  if(__sync_fetch_and_add(&pageref[PA2REF(pa)], 1) < 1)
+    panic("kaddref: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return pageref[PA2REF(pa)];
+}
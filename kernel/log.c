@@ -2,6 +2,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -28,7 +29,20 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A commit writes the whole log body as one batch of disk
+// requests, then the header, and then starts writing the
+// blocks to their home locations without waiting.  New FS
+// system calls can proceed while that install is in flight;
+// the next commit waits for it and erases the old header
+// before reusing the log.
+//
+// Commits are delayed: the last end_op() leaves the
+// transaction open, so that later system calls join it and
+// their writes of the same blocks are absorbed, until the
+// flusher thread finds it FLUSHAGE ticks old, it fills half
+// the log, or log_sync() (fsync) asks for a commit.  Until
+// then its blocks are dirty, pinned in the buffer cache.
+// A crash loses open transactions whole, never part of one.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,13 +57,22 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int installing;  // home-block writes of the last commit in flight.
+  int dirty;       // on-disk header still holds the last commit.
+  int flush;       // commit when the last outstanding op ends.
+  uint since;      // ticks when the open transaction's first block was logged.
+  uint ncommit;    // number of commits so far.
   int dev;
   struct logheader lh;
 };
 struct log log;
 
+#define LOGIO 16  // max disk writes in flight during recovery
+
 static void recover_from_log(void);
+static void write_head(int);
 static void commit();
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -62,23 +85,97 @@ initlog(int dev, struct superblock *sb)
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  if(kthread("flusher", flusher) < 0)
+    panic("initlog: flusher");
+}
+
+// Sort the logged block numbers, so that home blocks are
+// locked in ascending order and consecutive ones can share
+// a disk request.
+static void
+sort_log(void)
+{
+  int i, j, t;
+
+  for (i = 1; i < log.lh.n; i++) {
+    t = log.lh.block[i];
+    for (j = i; j > 0 && log.lh.block[j-1] > t; j--)
+      log.lh.block[j] = log.lh.block[j-1];
+    log.lh.block[j] = t;
+  }
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// during recovery.  Up to LOGIO writes are in flight at once.
 static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+install_trans(void)
+{
+  struct buf *dbuf[LOGIO];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > LOGIO)
+      n = LOGIO;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bsubmitv(dbuf, n, 1);  // write dst to disk
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
+  }
+}
+
+// Called by the disk interrupt when the install of a
+// committed block has finished.
+static void
+install_done(struct buf *b)
+{
+  bunpin(b);
+  brelse_async(b);
+  acquire(&log.lock);
+  log.installing -= 1;
+  if(log.installing == 0)
+    wakeup(&log.installing);
+  release(&log.lock);
+}
+
+// Start writing the committed blocks, which bufs holds
+// locked, to their home locations, and return without
+// waiting; install_done() releases each block when its
+// write finishes.  Meanwhile the next transaction can run,
+// and only waits if it uses one of these blocks.
+static void
+start_install(struct buf **bufs)
+{
+  int i;
+
+  acquire(&log.lock);
+  log.installing = log.lh.n;
+  release(&log.lock);
+  for (i = 0; i < log.lh.n; i++)
+    bufs[i]->done = install_done;
+  bsubmitv(bufs, log.lh.n, 1);
+}
+
+// Wait for the install started by the last commit, then
+// erase that transaction from the log, so that its log
+// blocks can be reused.
+static void
+end_install(void)
+{
+  acquire(&log.lock);
+  while(log.installing > 0)
+    sleep(&log.installing, &log.lock);
+  release(&log.lock);
+  if(log.dirty){
+    write_head(0);
+    log.dirty = 0;
   }
 }
 
@@ -96,17 +193,17 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the first n entries of the in-memory log header
+// to disk.  With n > 0 this is the true point at which the
+// current transaction commits; n == 0 erases it.
 static void
-write_head(void)
+write_head(int n)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
+  hb->n = n;
+  for (i = 0; i < n; i++) {
     hb->block[i] = log.lh.block[i];
   }
   bwrite(buf);
@@ -117,9 +214,25 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(0); // clear the log
+}
+
+// Commit the open transaction.  Caller must hold log.lock,
+// which is released during the disk writes, and there must be
+// no outstanding FS system calls.
+static void
+commit_locked(void)
+{
+  log.committing = 1;
+  log.flush = 0;
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
 }
 
 // called at the start of each FS system call.
@@ -131,8 +244,13 @@ begin_op(void)
     if(log.committing){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      // this op might exhaust log space; commit first.
+      if(log.outstanding == 0){
+        commit_locked();
+      } else {
+        log.flush = 1;
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -142,19 +260,19 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and a commit is due.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.lh.n >= LOGSIZE/2)
+    log.flush = 1;
+  if(log.outstanding == 0 && log.flush){
+    commit_locked();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,43 +280,79 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+// Commit all FS system calls that have finished, and wait
+// until the commit is on disk.
+void
+log_sync(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  if(log.committing || log.lh.n > 0){
+    target = log.ncommit + 1;
+    while(log.ncommit < target){
+      if(!log.committing && log.outstanding == 0 && log.lh.n > 0){
+        commit_locked();
+      } else {
+        if(!log.committing)
+          log.flush = 1;
+        sleep(&log, &log.lock);
+      }
+    }
+  }
+  release(&log.lock);
+}
+
+// The flusher thread commits the open transaction once it is
+// FLUSHAGE ticks old.
+static void
+flusher(void)
+{
+  for(;;){
+    sleepuntil(r_time() + (FLUSHAGE/2 + 1) * TICKCYCLES);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    if(!log.committing && log.lh.n > 0 && ticks - log.since >= FLUSHAGE){
+      if(log.outstanding == 0)
+        commit_locked();
+      else
+        log.flush = 1;
+    }
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the modified blocks, which bufs holds locked, to
+// the log.  They go straight from the cache, in as few disk
+// requests as possible, all in flight at once.
 static void
-write_log(void)
+write_log(struct buf **bufs)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
-  }
+  bwriteat(bufs, log.lh.n, log.start+1);
+  for (i = 0; i < log.lh.n; i++)
+    bwait(bufs[i]);
 }
 
 static void
 commit()
 {
+  struct buf *bufs[LOGSIZE];
+  int i;
+
   if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+    end_install();   // Finish and erase the previous transaction
+    sort_log();
+    for (i = 0; i < log.lh.n; i++)
+      bufs[i] = bread(log.dev, log.lh.block[i]); // cached and pinned
+    write_log(bufs);     // Write modified blocks from cache to log
+    write_head(log.lh.n);  // Write header to disk -- the real commit
+    log.dirty = 1;
+    start_install(bufs); // Install writes to home locations in the background
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
   }
 }
 
@@ -229,6 +383,8 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    if(log.lh.n == 0)
+      log.since = ticks;
     log.lh.n++;
   }
   release(&log.lock);
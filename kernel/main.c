@@ -11,6 +11,7 @@ void
 main()
 {
   if(cpuid() == 0){
+    lockinit();      // lock registry
     consoleinit();
     printfinit();
     printf("\n");
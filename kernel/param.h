@@ -1,13 +1,20 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         4  // scheduling priority levels
+#define BOOSTTICKS   20  // ticks between scheduling priority boosts
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of in-memory i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define NSEG          8  // max ELF segments per program
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*6)  // initial and minimum size of disk block cache
+#define BCACHEFRAC   8   // disk block cache may use 1/BCACHEFRAC of memory
+#define FLUSHAGE     10  // ticks a transaction may stay uncommitted
+#define NVEC          8  // max blocks per disk request
+#define FSSIZE       100000  // size of file system in blocks; its bitmap
+                             // blocks must fit in MAXOPBLOCKS for itrunc()
 #define MAXPATH      128   // maximum file path name
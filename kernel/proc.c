@@ -5,57 +5,260 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "stat.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table.  struct procs are carved out of pages,
+// "slabs", allocated as they are first needed, and a slab is
+// freed again once none of its procs is in use.
+//
+// Each slab owns NPERSLAB fixed kernel stack slots, KSTACK(),
+// with a guard page below each.  Its procs' stacks are mapped
+// when it is made and unmapped when it is freed, so the kernel
+// page table changes per slab, not per fork.  The page-table
+// pages for all slots are made at boot, so mapping only fills
+// in PTEs.  A CPU that may hold a stale TLB entry for a slot
+// would only use it by running the slot's next process, so
+// instead of a shootdown, mapping bumps kstackgen and the
+// scheduler flushes its TLB if kstackgen has moved.
+struct procslab {
+  struct procslab *next;   // on ptable.partial, if free != 0
+  struct procslab *prev;
+  struct proc *free;       // UNUSED procs, linked by freenext
+  int nused;               // procs that are not UNUSED
+  int slot;                // its stacks are KSTACK(slot*NPERSLAB + i)
+  struct proc proc[];
+};
+
+#define NPERSLAB ((PGSIZE - sizeof(struct procslab)) / sizeof(struct proc))
+#define NSLAB ((NPROC + NPERSLAB - 1) / NPERSLAB)
+#define SLAB(p) ((struct procslab*)PGROUNDDOWN((uint64)(p)))
+
+static uint kstackgen;
+
+static struct {
+  struct spinlock lock;
+  struct procslab *partial;  // slabs with an UNUSED proc
+  int n;                     // procs in use, at most NPROC
+  char slot[NSLAB];          // stack slots taken by a slab
+} ptable;
 
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Per-CPU run queues of RUNNABLE processes, one FIFO list per
+// priority level.  A process that becomes RUNNABLE joins the
+// queue of the CPU it last ran on, so that it tends to stay
+// where its cache is warm; a CPU with nothing to run steals
+// from the other queue with the most processes it may run.
+// A process's p->lock is acquired before a queue's lock.
+//
+// Scheduling is a multi-level feedback queue.  A process may
+// run for QUANTUM(prio) ticks at a level, summed over however
+// many times it gives up the CPU, and then drops a level; so
+// CPU-bound processes sink and ones that mostly sleep stay on
+// top.  Every BOOSTTICKS ticks all processes go back to the
+// highest level their nice value allows, so that none starve
+// and ones that have become interactive recover.  Boosts are
+// done lazily, as processes are queued, run, or picked.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;
+  int ncpu[NCPU];  // how many of n may run on CPU i
+  uint boost;  // boost period when the queue was last boosted
+} __attribute__ ((aligned (64)));
+
+static struct runq runq[NCPU];
+
+// Length of rq, and how many of its processes may run on
+// CPU id, read without its lock.
+#define RQLEN(rq) __atomic_load_n(&(rq)->n, __ATOMIC_RELAXED)
+#define RQFOR(rq, id) __atomic_load_n(&(rq)->ncpu[id], __ATOMIC_RELAXED)
+
+// A process may run on CPU i if bit i of p->affinity is set.
+#define ALLCPUS ((1L << NCPU) - 1)
+static uint64 online;  // CPUs that have entered scheduler()
+
+#define QUANTUM(prio) (1 << (prio))
+#define BOOST() (ticks / BOOSTTICKS)
+
+// Wait queues of SLEEPING processes, hashed by channel, so that
+// wakeup() looks only at the processes that might be sleeping
+// on its channel.  A wait queue's lock is acquired before the
+// p->lock of any process on it.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} __attribute__ ((aligned (64)));
+
+static struct waitq waitq[NWAITQ];
+
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void slabfree(struct procslab *s);
+static void siblink(struct proc **head, struct proc *c);
+static void kthreadret(void);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
-// memory model when using p->parent.
+// memory model when using p->parent and
+// the child lists.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
+// Processes with a pid, hashed by pid, so that kill() and
+// friends need not scan the process table.  pidtab.lock is
+// acquired before p->lock, so that a process found in the
+// hash can be locked before it can be freed.
+#define NPIDHASH 257
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+
+struct {
+  struct spinlock lock;
+  struct proc *hash[NPIDHASH];
+} pidtab;
+
+// initialize the proc table.
+void
+procinit(void)
+{
+  int i;
+  
+  initlock(&ptable.lock, "ptable");
+  initlock(&pid_lock, "nextpid");
+  initlock(&wait_lock, "wait_lock");
+  initlock(&pidtab.lock, "pidtab");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+}
+
+// Put s on, or take it off, the list of slabs with UNUSED
+// procs.  Caller must hold ptable.lock.
+static void
+slablink(struct procslab *s)
+{
+  s->prev = 0;
+  s->next = ptable.partial;
+  if(s->next)
+    s->next->prev = s;
+  ptable.partial = s;
+}
+
+static void
+slabunlink(struct procslab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    ptable.partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate the page-table pages for every kernel stack slot,
+// so that procgrow() need not.
 void
 proc_mapstacks(pagetable_t kpgtbl)
 {
+  int i;
+
+  for(i = 0; i < NSLAB * NPERSLAB; i++){
+    if(walk(kpgtbl, KSTACK(i), 1) == 0)
+      panic("proc_mapstacks");
+  }
+}
+
+// Add a page's worth of UNUSED procs to the process table,
+// with their kernel stacks.
+// Returns -1 if out of memory.
+static int
+procgrow(void)
+{
+  struct procslab *s;
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  char *pa;
+  int i;
+
+  if((s = (struct procslab*)kalloc()) == 0)
+    return -1;
+  memset(s, 0, PGSIZE);
+  acquire(&ptable.lock);
+  for(i = 0; i < NSLAB && ptable.slot[i]; i++)
+    ;
+  if(i < NSLAB)
+    ptable.slot[i] = 1;
+  release(&ptable.lock);
+  if(i == NSLAB){
+    // every slot's slab is full, so there are NPROC procs.
+    kfree((void*)s);
+    return -1;
+  }
+  s->slot = i;
+
+  for(p = s->proc; p < &s->proc[NPERSLAB]; p++){
+    initlock(&p->lock, "proc");
+    p->state = UNUSED;
+    p->freenext = s->free;
+    s->free = p;
   }
+  for(p = s->proc; p < &s->proc[NPERSLAB]; p++){
+    if((pa = kalloc()) == 0){
+      slabfree(s);
+      return -1;
+    }
+    p->kstack = KSTACK(s->slot * NPERSLAB + (p - s->proc));
+    *walk(kernel_pagetable, p->kstack, 0) = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+  }
+  __atomic_add_fetch(&kstackgen, 1, __ATOMIC_RELEASE);
+
+  acquire(&ptable.lock);
+  slablink(s);
+  release(&ptable.lock);
+  return 0;
 }
 
-// initialize the proc table.
-void
-procinit(void)
+// Free a slab none of whose procs is in use, and their stacks.
+// It is already off ptable.partial, and none of its procs is
+// in pidtab, but lockpid() may have locked one just before it
+// left; wait for each lock to be let go before the memory goes.
+// A stale TLB entry for an unmapped stack is harmless until
+// procgrow() maps the slot again and bumps kstackgen.
+static void
+slabfree(struct procslab *s)
 {
   struct proc *p;
-  
-  initlock(&pid_lock, "nextpid");
-  initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
+  pte_t *pte;
+  uint64 pa;
+
+  for(p = s->proc; p < &s->proc[NPERSLAB]; p++){
+    acquire(&p->lock);
+    release(&p->lock);
+    freelock(&p->lock);
+    if(p->kstack){
+      pte = walk(kernel_pagetable, p->kstack, 0);
+      pa = PTE2PA(*pte);
+      *pte = 0;
+      kfree((void*)pa);
+    }
   }
+  acquire(&ptable.lock);
+  ptable.slot[s->slot] = 0;
+  release(&ptable.lock);
+  kfree((void*)s);
 }
 
 // Must be called with interrupts disabled,
@@ -102,41 +305,292 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Interrupt CPU id with an IPI.
+static void
+ipi(int id)
+{
+  *(volatile uint32*)CLINT_MSIP(id) = 1;
+}
+
+// Wake a CPU to run p, just put on CPU id's run queue: CPU id
+// itself if it is idle or running something of lower priority,
+// else any idle CPU p may run on, which will steal p.  The
+// fence pairs with the one in idle(), so that either the idle
+// CPU sees p on the queue or we see that the CPU is idle.
+static void
+kick(int id, struct proc *p)
+{
+  int i;
+
+  __sync_synchronize();
+  if(!cpus[id].idle){
+    if(cpus[id].proc && cpus[id].prio > p->prio){
+      __atomic_store_n(&cpus[id].resched, 1, __ATOMIC_RELAXED);
+    } else {
+      for(i = 0; i < NCPU && !(cpus[i].idle && (p->affinity & (1L << i))); i++)
+        ;
+      if(i == NCPU)
+        return;
+      id = i;
+    }
+  }
+  ipi(id);
+}
+
+// Give p a fresh start at its highest allowed level
+// if a boost period has passed since its last one.
+static void
+boost(struct proc *p)
+{
+  if(p->boost != BOOST()){
+    p->boost = BOOST();
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+
+// Append p to rq's list for its level.
+// Caller must hold rq->lock.
+static void
+runq_add(struct runq *rq, struct proc *p)
+{
+  int i;
+
+  p->rqnext = 0;
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+  for(i = 0; i < NCPU; i++)
+    if(p->affinity & (1L << i))
+      rq->ncpu[i]++;
+}
+
+// Take p, which follows prev, off rq's list for its level.
+// Caller must hold rq->lock.
+static void
+runq_unlink(struct runq *rq, struct proc *p, struct proc *prev)
+{
+  int i;
+
+  if(prev)
+    prev->rqnext = p->rqnext;
+  else
+    rq->head[p->prio] = p->rqnext;
+  if(rq->tail[p->prio] == p)
+    rq->tail[p->prio] = prev;
+  rq->n--;
+  for(i = 0; i < NCPU; i++)
+    if(p->affinity & (1L << i))
+      rq->ncpu[i]--;
+}
+
+// Take p off rq and return 1, or return 0 if a scheduler
+// has already taken it.
+// Caller must hold p->lock.
+static int
+runq_remove(struct runq *rq, struct proc *p)
+{
+  struct proc *q, *prev;
+
+  acquire(&rq->lock);
+  prev = 0;
+  for(q = rq->head[p->prio]; q && q != p; q = q->rqnext)
+    prev = q;
+  if(q)
+    runq_unlink(rq, p, prev);
+  release(&rq->lock);
+  return q != 0;
+}
+
+// Mark p RUNNABLE and add it to its CPU's run queue, or if
+// p may not run there, to the shortest queue of a CPU that
+// it may run on.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+  int i, best;
+
+  if(!(p->affinity & (1L << p->cpu))){
+    best = -1;
+    for(i = 0; i < NCPU; i++)
+      if((p->affinity & online & (1L << i)) && (best < 0 || RQLEN(&runq[i]) < RQLEN(&runq[best])))
+        best = i;
+    if(best >= 0)
+      p->cpu = best;
+  }
+  rq = &runq[p->cpu];
+
+  p->state = RUNNABLE;
+  boost(p);
+  acquire(&rq->lock);
+  runq_add(rq, p);
+  release(&rq->lock);
+
+  // a yield()ing process will be picked up by its own
+  // CPU as soon as it gets to the scheduler.
+  if(p != myproc())
+    kick(p->cpu, p);
+}
+
+// Boost every process on rq, keeping their order.
+// Caller must hold rq->lock.
+static void
+runq_boost(struct runq *rq)
+{
+  struct proc *list, **tailp, *p;
+  int i;
+
+  list = 0;
+  tailp = &list;
+  for(i = 0; i < NPRIO; i++){
+    *tailp = rq->head[i];
+    if(rq->tail[i])
+      tailp = &rq->tail[i]->rqnext;
+    rq->head[i] = rq->tail[i] = 0;
+  }
+  rq->n = 0;
+  memset(rq->ncpu, 0, sizeof(rq->ncpu));
+  while((p = list) != 0){
+    list = p->rqnext;
+    boost(p);
+    runq_add(rq, p);
+  }
+  rq->boost = BOOST();
+}
+
+// Take the first process at the highest non-empty level of
+// rq that may run on CPU id, or return 0 if there is none.
+static struct proc*
+runq_pop(struct runq *rq, int id)
+{
+  struct proc *p, *prev;
+  int i;
+
+  if(RQLEN(rq) == 0)  // racy peek, to save taking the lock
+    return 0;
+  acquire(&rq->lock);
+  if(rq->boost != BOOST())
+    runq_boost(rq);
+  p = 0;
+  for(i = 0; i < NPRIO && p == 0; i++){
+    prev = 0;
+    for(p = rq->head[i]; p && !(p->affinity & (1L << id)); p = p->rqnext)
+      prev = p;
+    if(p)
+      runq_unlink(rq, p, prev);
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Find a process for CPU id to run: the next on its own
+// queue, else one from the other queues, longest first,
+// that may run on CPU id.
+static struct proc*
+runq_next(int id)
+{
+  struct proc *p;
+  int i, best, tried;
+
+  if((p = runq_pop(&runq[id], id)) != 0)
+    return p;
+  tried = 1L << id;
+  for(;;){
+    best = -1;
+    for(i = 0; i < NCPU; i++)
+      if(!(tried & (1L << i)) && RQFOR(&runq[i], id) > 0 &&
+         (best < 0 || RQFOR(&runq[i], id) > RQFOR(&runq[best], id)))
+        best = i;
+    if(best < 0)
+      return 0;
+    if((p = runq_pop(&runq[best], id)) != 0)
+      return p;
+    tried |= 1L << best;
+  }
+}
+
+// Wait for an interrupt, with the periodic tick off, unless
+// some run queue has a process that may run on this CPU.
+// kick() sends an IPI to an idle CPU when it queues work
+// for it.
+static void
+idle(struct cpu *c)
+{
+  int i, id;
+
+  intr_off();
+  id = c - cpus;
+  c->idle = 1;
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    if(RQFOR(&runq[i], id))
+      break;
+  if(i == NCPU){
+    timeridle(1);
+    asm volatile("wfi");
+    timeridle(0);
+  }
+  c->idle = 0;
+}
+
+// Take an UNUSED proc from the process table, growing the
+// table if need be, initialize state required to run in the
+// kernel, and return with p->lock held.
+// If there are NPROC procs in use, or a memory allocation
+// fails, return 0.
 static struct proc*
 allocproc(void)
 {
+  struct procslab *s;
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+  for(;;){
+    acquire(&ptable.lock);
+    if(ptable.n >= NPROC){
+      release(&ptable.lock);
+      return 0;
     }
+    if((s = ptable.partial) != 0){
+      p = s->free;
+      s->free = p->freenext;
+      if(s->free == 0)
+        slabunlink(s);
+      s->nused++;
+      ptable.n++;
+      release(&ptable.lock);
+      break;
+    }
+    release(&ptable.lock);
+    if(procgrow() < 0)
+      return 0;
   }
-  return 0;
 
-found:
-  p->pid = allocpid();
+  // Nothing else can find p until it is in pidtab, so it can
+  // be set up without p->lock.
   p->state = USED;
+  p->nice = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->boost = BOOST();
+  p->affinity = ALLCPUS;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+    acquire(&p->lock);
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
+    acquire(&p->lock);
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
@@ -146,15 +600,27 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  p->pid = allocpid();
+  acquire(&pidtab.lock);
+  p->pidnext = pidtab.hash[PIDHASH(p->pid)];
+  pidtab.hash[PIDHASH(p->pid)] = p;
+  release(&pidtab.lock);
+
+  acquire(&p->lock);
   return p;
 }
 
 // free a proc structure and the data hanging from it,
 // including user pages.
-// p->lock must be held.
+// p->lock must be held; freeproc() releases it.
 static void
 freeproc(struct proc *p)
 {
+  struct procslab *s;
+  struct proc **pp;
+  int pid;
+
+  pid = p->pid;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
@@ -168,7 +634,33 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->nseg = 0;
+  p->kfn = 0;
   p->state = UNUSED;
+  release(&p->lock);
+
+  if(pid){
+    acquire(&pidtab.lock);
+    for(pp = &pidtab.hash[PIDHASH(pid)]; *pp != p; pp = &(*pp)->pidnext)
+      ;
+    *pp = p->pidnext;
+    release(&pidtab.lock);
+  }
+
+  s = SLAB(p);
+  acquire(&ptable.lock);
+  p->freenext = s->free;
+  s->free = p;
+  if(p->freenext == 0)
+    slablink(s);
+  ptable.n--;
+  if(--s->nused == 0)
+    slabunlink(s);
+  else
+    s = 0;
+  release(&ptable.lock);
+  if(s)
+    slabfree(s);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -249,12 +741,35 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn(), which must not
+// return, in the kernel with no user memory.
+// Returns its pid, or -1 if there is no free proc.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  p->cpu = cpuid();
+  setrunnable(p);
+  release(&p->lock);
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; vmfault() allocates
+// each new page the first time it is touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -264,9 +779,9 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > TRAPFRAME)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -291,7 +806,6 @@ fork(void)
   // Copy user memory from parent to child.
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
-    release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
@@ -307,6 +821,12 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->execip){
+    np->execip = idup(p->execip);
+    idenywrite(np->execip);
+  }
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -316,28 +836,66 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  siblink(&p->children, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->cpu = p->cpu;
+  np->nice = p->nice;
+  np->prio = p->nice;
+  np->affinity = p->affinity;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Add c to the child list *head.
+// Caller must hold wait_lock.
+static void
+siblink(struct proc **head, struct proc *c)
+{
+  c->sibprev = 0;
+  c->sibnext = *head;
+  if(*head)
+    (*head)->sibprev = c;
+  *head = c;
+}
+
+// Remove c from the child list *head.
+// Caller must hold wait_lock.
+static void
+sibunlink(struct proc **head, struct proc *c)
+{
+  if(c->sibprev)
+    c->sibprev->sibnext = c->sibnext;
+  else
+    *head = c->sibnext;
+  if(c->sibnext)
+    c->sibnext->sibprev = c->sibprev;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
+  int zombies;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  while((pp = p->children) != 0){
+    sibunlink(&p->children, pp);
+    pp->parent = initproc;
+    siblink(&initproc->children, pp);
   }
+  zombies = p->zombies != 0;
+  while((pp = p->zombies) != 0){
+    sibunlink(&p->zombies, pp);
+    pp->parent = initproc;
+    siblink(&initproc->zombies, pp);
+  }
+  if(zombies)
+    wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -362,8 +920,13 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip){
+    iallowwrite(p->execip);
+    iput(p->execip);
+  }
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
@@ -377,6 +940,8 @@ exit(int status)
 
   p->xstate = status;
   p->state = ZOMBIE;
+  sibunlink(&p->parent->children, p);
+  siblink(&p->parent->zombies, p);
 
   release(&wait_lock);
 
@@ -385,53 +950,77 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// Return the process with the given pid, or 0.
+// Caller must hold pidtab.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = pidtab.hash[PIDHASH(pid)]; p && p->pid != pid; p = p->pidnext)
+    ;
+  return p;
+}
+
+// Wait for the child process with the given pid, or for any
+// child if pid is -1, to exit and return its pid.
+// Return -1 if there is no such child.
 int
-wait(uint64 addr)
+waitpid(int pid, uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with locks held.
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int));
+
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    // Exited children are on p->zombies; wait_lock keeps
+    // our children from being freed or given away.
+    if(pid == -1){
+      pp = p->zombies;
+      if(pp == 0 && p->children == 0)
+        break;
+    } else {
+      acquire(&pidtab.lock);
+      pp = findproc(pid);
+      if(pp && pp->parent != p)
+        pp = 0;
+      release(&pidtab.lock);
+      if(pp == 0)
+        break;
+    }
+
+    if(pp){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+      if(pp->state == ZOMBIE){
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
-          release(&wait_lock);
-          return pid;
+          break;
         }
-        release(&pp->lock);
+        sibunlink(&p->zombies, pp);
+        freeproc(pp);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
-    // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
-      release(&wait_lock);
-      return -1;
-    }
+    // No point waiting if we have been killed.
+    if(killed(p))
+      break;
     
     // Wait for a child to exit.
     sleep(p, &wait_lock);  //DOC: wait-sleep
   }
+  release(&wait_lock);
+  return -1;
 }
 
 // Per-CPU process scheduler.
@@ -446,30 +1035,56 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  uint gen;
 
   c->proc = 0;
+  __atomic_or_fetch(&online, 1L << id, __ATOMIC_RELAXED);
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
+    if((p = runq_next(id)) == 0){
+      idle(c);
+      continue;
+    }
+
+    // A process that yield()ed may still be on its way
+    // out of another CPU; p->lock waits for it to get off.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if(!(p->affinity & (1L << id))){
+      // setaffinity() changed its mind after we picked p.
+      setrunnable(p);
       release(&p->lock);
+      continue;
+    }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    if(p->cpu != id)
+      c->nmigrate++;
+    c->nswitch++;
+    p->cpu = id;
+    c->prio = p->prio;
+    c->proc = p;
+    gen = __atomic_load_n(&kstackgen, __ATOMIC_ACQUIRE);
+    if(c->kstackgen != gen){
+      // p's stack may be in a slot that was mapped since.
+      c->kstackgen = gen;
+      sfence_vma();
     }
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -500,13 +1115,66 @@ sched(void)
   mycpu()->intena = intena;
 }
 
+// Charge the running process for a clock tick.  If it has
+// used up its time at this level, or a process of higher
+// priority is waiting for this CPU, ask devintr() to have
+// it yield().
+// Called from devintr() with interrupts off.
+void
+schedtick(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p = c->proc;
+  struct runq *rq = &runq[cpuid()];
+  int i;
+
+  if(p == 0 || p->state != RUNNING)
+    return;
+  boost(p);
+  if(++p->slice >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = 0;
+    c->resched = 1;
+  } else {
+    for(i = 0; i < p->prio; i++)
+      if(__atomic_load_n(&rq->head[i], __ATOMIC_RELAXED))
+        c->resched = 1;
+  }
+  c->prio = p->prio;
+}
+
+// Set the calling process's nice value, the highest
+// priority level it may run at, to its current value
+// plus inc, within [0, NPRIO-1].  Returns the new value.
+int
+nice(int inc)
+{
+  struct proc *p = myproc();
+  int n;
+
+  n = p->nice + inc;
+  if(n < 0)
+    n = 0;
+  if(n > NPRIO-1)
+    n = NPRIO-1;
+  push_off();  // schedtick() also changes prio
+  p->nice = n;
+  if(p->prio < n){
+    p->prio = n;
+    p->slice = 0;
+  }
+  pop_off();
+  return n;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -535,34 +1203,73 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's first scheduling swtch()es here.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Remove p from wait queue wq.
+// Caller must hold wq->lock.
+static void
+waitq_remove(struct waitq *wq, struct proc *p)
+{
+  if(p->wprev)
+    p->wprev->wnext = p->wnext;
+  else
+    wq->head = p->wnext;
+  if(p->wnext)
+    p->wnext->wprev = p->wprev;
+  p->wq = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+  // Must join chan's wait queue, and change p->state,
+  // before releasing lk.  wakeup() takes the wait queue's
+  // lock and then each sleeper's p->lock, so once we hold
+  // both we can't miss a wakeup and it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wq = wq;
+  p->wprev = 0;
+  p->wnext = wq->head;
+  if(wq->head)
+    wq->head->wprev = p;
+  wq->head = p;
+  release(&wq->lock);
 
   sched();
 
-  // Tidy up.
+  // Tidy up.  wakeup() takes p off the wait queue, but kill()
+  // leaves it there; no wakeup() will touch p now that p->chan
+  // is clear, so it is safe to check p->wq without p->lock.
   p->chan = 0;
+  release(&p->lock);
+  if((wq = p->wq) != 0){
+    acquire(&wq->lock);
+    waitq_remove(wq, p);
+    release(&wq->lock);
+  }
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -571,17 +1278,109 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, *next;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next){
+    next = p->wnext;
     if(p != myproc()){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING && p->chan == chan){
+        waitq_remove(wq, p);
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
+}
+
+// Find the process with the given pid, or the caller if pid
+// is 0, and return it with p->lock held; or return 0.
+static struct proc*
+lockpid(int pid)
+{
+  struct proc *p;
+
+  if(pid == 0){
+    p = myproc();
+    acquire(&p->lock);
+    return p;
+  }
+  acquire(&pidtab.lock);
+  if((p = findproc(pid)) != 0)
+    acquire(&p->lock);
+  release(&pidtab.lock);
+  if(p && p->pid != pid){
+    // on its way out of freeproc().
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// Restrict the process with the given pid (0 for the caller)
+// to the CPUs in mask.  If it is on a CPU outside the mask it
+// moves at once: to another run queue if RUNNABLE, or by being
+// made to yield() if RUNNING.  Returns -1 if there is no such
+// process or mask has no CPU that is running.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  int moved;
+
+  mask &= ALLCPUS;
+  if((mask & online) == 0 || (p = lockpid(pid)) == 0)
+    return -1;
+  moved = 0;
+  if(p->state == RUNNABLE && runq_remove(&runq[p->cpu], p)){
+    // re-queue, since the queue counts processes per CPU.
+    p->affinity = mask;
+    setrunnable(p);
+  } else {
+    // if a scheduler has just taken p, it will check the mask.
+    p->affinity = mask;
+    if(p->state == RUNNING && !(mask & (1L << p->cpu)))
+      moved = 1;
+  }
+  if(moved && p != myproc()){
+    __atomic_store_n(&cpus[p->cpu].resched, 1, __ATOMIC_RELAXED);
+    ipi(p->cpu);
+  }
+  release(&p->lock);
+  if(moved && p == myproc())
+    yield();
+  return 0;
+}
+
+// Return the CPU mask of the process with the given pid
+// (0 for the caller), or 0 if there is no such process.
+uint64
+getaffinity(int pid)
+{
+  struct proc *p;
+  uint64 mask;
+
+  if((p = lockpid(pid)) == 0)
+    return 0;
+  mask = p->affinity;
+  release(&p->lock);
+  return mask;
+}
+
+// Copy CPU id's scheduling statistics to *st.
+// Returns -1 if there is no such CPU.
+int
+cpustat(int id, struct schedstat *st)
+{
+  if(id < 0 || id >= NCPU)
+    return -1;
+  st->online = (online >> id) & 1;
+  st->nswitch = cpus[id].nswitch;
+  st->nmigrate = cpus[id].nmigrate;
+  return 0;
 }
 
 // Kill the process with the given pid.
@@ -592,20 +1391,15 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if(pid <= 0 || (p = lockpid(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -659,7 +1453,9 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Procs may be freed, so the listing needs pidtab.lock to
+// keep them; but it gives up rather than wait for the lock,
+// to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
@@ -673,16 +1469,24 @@ procdump(void)
   };
   struct proc *p;
   char *state;
+  int i;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+  if(!tryacquire(&pidtab.lock)){
+    printf("procdump: pidtab is locked\n");
+    return;
+  }
+  for(i = 0; i < NPIDHASH; i++){
+    for(p = pidtab.hash[i]; p; p = p->pidnext){
+      if(p->state == UNUSED)
+        continue;
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      printf("%d %s %d %s", p->pid, state, p->prio, p->name);
+      printf("\n");
+    }
   }
+  release(&pidtab.lock);
 }
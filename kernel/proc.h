@@ -24,6 +24,13 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 tickat;              // Time of the last tick devintr() saw.
+  int idle;                   // Waiting in wfi for work; see kick().
+  int prio;                   // Priority of the process running here.
+  int resched;                // Set to make devintr() ask for a yield().
+  uint nswitch;               // Processes switched to
+  uint nmigrate;              // ... that last ran on another CPU
+  uint kstackgen;             // kstackgen as of this CPU's last sfence.vma
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +86,17 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable ELF segment of the running program. exec() only
+// records it; vmfault() reads each page from the program file
+// the first time it is touched, and zero-fills the bss.
+struct vmseg {
+  uint64 va;                   // page-aligned start address
+  uint64 memsz;                // size in memory
+  uint64 filesz;               // bytes of file data; the rest is zero
+  uint64 off;                  // file offset of the data at va
+  int perm;                    // PTE_X and/or PTE_W
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,9 +109,38 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU it last ran on, whose run queue it joins
+
+  // the run queue's lock must be held when using these while
+  // p is RUNNABLE; while p is RUNNING only its CPU uses them.
+  struct proc *rqnext;         // Next process on the run queue
+  int prio;                    // Priority level, 0 highest; never above nice
+  int slice;                   // Ticks used at this level
+  uint boost;                  // Boost period when prio was last reset
+  int nice;                    // Highest priority level allowed
+  uint64 affinity;             // CPUs it may run on, one bit each
+
+  // the wait queue's lock must be held when using these:
+  struct waitq *wq;            // Wait queue of chan, while on it
+  struct proc *wnext;          // Neighbours on the wait queue
+  struct proc *wprev;
 
-  // wait_lock must be held when using this:
+  // the timer queue's lock must be held when using these:
+  uint64 wakeat;               // If non-zero, deadline on the timer queue
+  struct proc *tnext;          // Next process on the timer queue
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Children still running
+  struct proc *zombies;        // Exited children not yet waited for
+  struct proc *sibnext;        // Neighbours on the parent's children
+  struct proc *sibprev;        //   or zombies list
+
+  // pidtab.lock must be held when using this:
+  struct proc *pidnext;        // Next process in the pid hash chain
+
+  // ptable.lock must be held when using this:
+  struct proc *freenext;       // Next UNUSED proc in its slab
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
@@ -103,5 +150,9 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Program file backing seg[]
+  int nseg;                    // Number of valid entries in seg[]
+  struct vmseg seg[NSEG];      // Lazily loaded program segments
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Body of a kernel thread, else 0
 };
@@ -18,6 +18,17 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->pid = 0;
 }
 
+// Initialize a sleep lock whose spinlock lockstat() does not
+// record; see initlock_nostat().
+void
+initsleeplock_nostat(struct sleeplock *lk, char *name)
+{
+  initlock_nostat(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+  lk->pid = 0;
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
@@ -8,12 +8,85 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every initialized lock is recorded here so that lockstat()
+// can report contention, except for the many per-buffer locks,
+// which the buffer cache counts in aggregate instead; see
+// initlock_nostat().  There is room for a lock per process
+// and per in-memory inode, and the fixed and per-pipe locks.
+// Locks that live in memory that is later freed must be
+// removed with freelock().  A recorded lock remembers its
+// slot, and freed slots are kept on a stack, so recording
+// and forgetting a lock take constant time.
+#define NLOCK (NPROC + 2048)
+
+static struct spinlock *locks[NLOCK];
+static int nlock;                  // slots in use are below this
+static int freeslot[NLOCK];        // slots below nlock not in use
+static int nfree;
+static struct spinlock lockslock;  // protects the above; not itself recorded
+
 void
-initlock(struct spinlock *lk, char *name)
+lockinit(void)
+{
+  initlock_nostat(&lockslock, "lockslock");
+}
+
+// Initialize a lock without recording it.
+void
+initlock_nostat(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->slot = -1;
+}
+
+// Is lk recorded?  lk->slot may be garbage if lk's memory was
+// never initialized, so check that the slot holds lk.
+static int
+recorded(struct spinlock *lk)
+{
+  return lk->slot >= 0 && lk->slot < nlock && locks[lk->slot] == lk;
+}
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  static int full;
+  int slot;
+
+  acquire(&lockslock);
+  slot = recorded(lk) ? lk->slot : -1;
+  initlock_nostat(lk, name);
+  if(slot < 0){
+    if(nfree > 0)
+      slot = freeslot[--nfree];
+    else if(nlock < NLOCK)
+      slot = nlock++;
+    if(slot >= 0)
+      locks[slot] = lk;
+    else if(!full){
+      full = 1;
+      printf("initlock: registry full, lockstat will miss %s and later locks\n", name);
+    }
+  }
+  lk->slot = slot;
+  release(&lockslock);
+}
+
+// Forget a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lockslock);
+  if(recorded(lk)){
+    locks[lk->slot] = 0;
+    freeslot[nfree++] = lk->slot;
+    lk->slot = -1;
+  }
+  release(&lockslock);
 }
 
 // Acquire the lock.
@@ -29,8 +102,9 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  uint nts = 0;
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    nts++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +114,26 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->n++;
+  lk->nts += nts;
+}
+
+// Acquire the lock if it is free, without spinning.
+// Returns 1 if it did, 0 if the lock is held.
+int
+tryacquire(struct spinlock *lk)
+{
+  push_off();
+  if(holding(lk))
+    panic("tryacquire");
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    pop_off();
+    return 0;
+  }
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  lk->n++;
+  return 1;
 }
 
 // Release the lock.
@@ -108,3 +202,29 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Print acquire and spin counts of the recorded locks whose
+// names start with prefix (all locks if prefix is empty) and
+// that have been contended.  Returns the total number of
+// spins of the matching locks.
+int
+lockstat(char *prefix)
+{
+  struct spinlock *lk;
+  int i, len, tot;
+
+  len = strlen(prefix);
+  tot = 0;
+  acquire(&lockslock);
+  for(i = 0; i < nlock; i++){
+    lk = locks[i];
+    if(lk == 0 || strncmp(lk->name, prefix, len) != 0)
+      continue;
+    tot += lk->nts;
+    if(lk->nts > 0)
+      printf("lock: %s: #acquire %d #test-and-set %d\n", lk->name, lk->n, lk->nts);
+  }
+  release(&lockslock);
+  printf("lockstat: %s* total #test-and-set %d\n", prefix, tot);
+  return tot;
+}
@@ -5,5 +5,10 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat():
+  uint n;            // Number of acquires.
+  uint nts;          // Number of failed test-and-sets while spinning.
+  int slot;          // Index in the lock registry, or -1.
 };
 
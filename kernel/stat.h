@@ -2,6 +2,23 @@
 #define T_FILE    2   // File
 #define T_DEVICE  3   // Device
 
+// Buffer cache statistics, from bcachestat().
+struct bcstat {
+  uint hits;    // block found in the cache
+  uint misses;  // block not cached
+  uint nbuf;    // buffers now
+  uint maxbuf;  // most buffers the cache may grow to
+  uint lockn;   // acquires of the buffers' locks
+  uint lockts;  // ... and their spins
+};
+
+// Per-CPU scheduling statistics, from cpustat().
+struct schedstat {
+  uint online;    // CPU has started
+  uint nswitch;   // processes switched to
+  uint nmigrate;  // ... that last ran on another CPU
+};
+
 struct stat {
   int dev;     // File system's disk device
   uint ino;    // Inode number
@@ -101,6 +101,15 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_bcachestat(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_nice(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_sched_getaffinity(void);
+extern uint64 sys_cpustat(void);
+extern uint64 sys_waitpid(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +135,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_lockstat] sys_lockstat,
+[SYS_fsync]   sys_fsync,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_nice]    sys_nice,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_cpustat] sys_cpustat,
+[SYS_waitpid] sys_waitpid,
 };
 
 void
@@ -20,3 +20,12 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_lockstat 22
+#define SYS_fsync  23
+#define SYS_bcachestat 24
+#define SYS_nanosleep 25
+#define SYS_nice   26
+#define SYS_sched_setaffinity 27
+#define SYS_sched_getaffinity 28
+#define SYS_cpustat 29
+#define SYS_waitpid 30
@@ -107,6 +107,21 @@ sys_close(void)
   return 0;
 }
 
+// Make the file system changes made so far durable.
+// Transactions commit as a whole, so this covers every
+// file, not only fd's.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE)
+    log_sync();
+  return 0;
+}
+
 uint64
 sys_fstat(void)
 {
@@ -136,7 +151,7 @@ sys_link(void)
   }
 
   ilock(ip);
-  if(ip->type == T_DIR){
+  if(ip->type == T_DIR || ip->nlink >= MAXLINK){
     iunlockput(ip);
     end_op();
     return -1;
@@ -222,6 +237,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -341,6 +357,13 @@ sys_open(void)
     return -1;
   }
 
+  if((omode & O_TRUNC) && ip->type == T_FILE && iwritedenied(ip)){
+    // a running program's pages are read from it.
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -355,6 +378,9 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->raend = 0;
+    f->ranext = 0;
+    f->rawin = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "stat.h"
 
 uint64
 sys_exit(void)
@@ -32,7 +33,7 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
-  return wait(p);
+  return waitpid(-1, p);
 }
 
 uint64
@@ -52,22 +53,21 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// Sleep for at least the given number of nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, nspercycle = 1000000000 / MTIMEHZ;
+
+  argaddr(0, &ns);
+  return sleepuntil(r_time() + (ns + nspercycle - 1) / nspercycle);
 }
 
 uint64
@@ -91,3 +91,95 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// print lock contention statistics for locks
+// whose names start with the given prefix.
+uint64
+sys_lockstat(void)
+{
+  char prefix[16];
+
+  if(argstr(0, prefix, sizeof(prefix)) < 0)
+    return -1;
+  return lockstat(prefix);
+}
+
+// copy buffer cache statistics to the user's struct bcstat.
+uint64
+sys_bcachestat(void)
+{
+  uint64 addr;
+  struct bcstat st;
+
+  argaddr(0, &addr);
+  bstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_nice(void)
+{
+  int inc;
+
+  argint(0, &inc);
+  return nice(inc);
+}
+
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+// copy the CPU mask of a process to the user's uint64.
+uint64
+sys_sched_getaffinity(void)
+{
+  int pid;
+  uint64 addr, mask;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if((mask = getaffinity(pid)) == 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&mask, sizeof(mask)) < 0)
+    return -1;
+  return 0;
+}
+
+// copy a CPU's scheduling statistics to the user's struct schedstat.
+uint64
+sys_cpustat(void)
+{
+  int id;
+  uint64 addr;
+  struct schedstat st;
+
+  argint(0, &id);
+  argaddr(1, &addr);
+  if(cpustat(id, &st) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_waitpid(void)
+{
+  int pid;
+  uint64 p;
+
+  argint(0, &pid);
+  argaddr(1, &p);
+  if(pid < -1 || pid == 0)
+    return -1;
+  return waitpid(pid, p);
+}
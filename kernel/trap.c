@@ -8,6 +8,18 @@
 
 struct spinlock tickslock;
 uint ticks;
+static uint64 tickbase;  // time CSR when ticks was 0
+
+// Processes in sleepuntil(), sorted by deadline, so that each
+// is woken once, when its deadline passes, rather than on
+// every tick.  The CPU that puts a new earliest deadline on
+// the queue asks its CLINT for an interrupt at that time.
+struct {
+  struct spinlock lock;
+  struct proc *head;
+} timers;
+
+extern uint64 timer_scratch[NCPU][9];  // start.c
 
 extern char trampoline[], uservec[], userret[];
 
@@ -20,6 +32,8 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  initlock(&timers.lock, "timers");
+  tickbase = r_time();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +79,10 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // page fault on an untouched program or heap page,
+    // or a copy-on-write page; the page is now mapped.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,7 +94,7 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if the scheduler asks.
   if(which_dev == 2)
     yield();
 
@@ -150,7 +168,7 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if the scheduler asks.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
     yield();
 
@@ -160,19 +178,135 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date.  Idle harts skip their ticks, so
+// ticks is worked out from the time rather than counted, and
+// any CPU taking a timer interrupt or an IPI may advance it.
 void
 clockintr()
 {
+  uint t = (r_time() - tickbase) / TICKCYCLES;
+
+  if(t == ticks)
+    return;
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if((int)(t - ticks) > 0)
+    ticks = t;
   release(&tickslock);
 }
 
+// Ask this CPU's timer for an interrupt at time when,
+// if that is sooner than any deadline it already has.
+// timervec in kernelvec.S may run at any moment, since
+// it is a machine-mode interrupt; the worst it can
+// cause is an extra interrupt.
+// Caller must have interrupts off.
+static void
+timerarm(uint64 when)
+{
+  int id = cpuid();
+  volatile uint64 *scratch = timer_scratch[id];
+  volatile uint64 *mtimecmp = (uint64*)CLINT_MTIMECMP(id);
+
+  if(when < scratch[7]){
+    scratch[7] = when;
+    if(when < *mtimecmp)
+      *mtimecmp = when;
+  }
+}
+
+// Tell this CPU's timervec whether the CPU is idle.  An idle
+// CPU takes no ticks, only its timer deadline (if any), so
+// that it can stay in wfi; on leaving idle, ask for the
+// missed tick at once.
+// Caller must have interrupts off.
+void
+timeridle(int idle)
+{
+  int id = cpuid();
+  volatile uint64 *scratch = timer_scratch[id];
+  volatile uint64 *mtimecmp = (uint64*)CLINT_MTIMECMP(id);
+
+  scratch[8] = idle;
+  if(idle)
+    *mtimecmp = scratch[7];
+  else if(scratch[6] < *mtimecmp)
+    *mtimecmp = scratch[6];
+}
+
+// Remove p from the timer queue.
+// Caller must hold timers.lock.
+static void
+timerremove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &timers.head; *pp; pp = &(*pp)->tnext){
+    if(*pp == p){
+      *pp = p->tnext;
+      break;
+    }
+  }
+  p->wakeat = 0;
+}
+
+// Wake the processes whose deadlines have passed.
+static void
+timerintr(void)
+{
+  struct proc *p;
+  uint64 now;
+
+  if(__atomic_load_n(&timers.head, __ATOMIC_RELAXED) == 0)
+    return;
+  acquire(&timers.lock);
+  now = r_time();
+  while((p = timers.head) != 0 && p->wakeat <= now){
+    timers.head = p->tnext;
+    p->wakeat = 0;
+    wakeup(&p->wakeat);
+  }
+  if(timers.head)
+    timerarm(timers.head->wakeat);
+  release(&timers.lock);
+}
+
+// Sleep until the time CSR reaches when.
+// Returns -1 if killed first.
+int
+sleepuntil(uint64 when)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+
+  acquire(&timers.lock);
+  while(r_time() < when){
+    if(killed(p)){
+      if(p->wakeat)
+        timerremove(p);
+      release(&timers.lock);
+      return -1;
+    }
+    if(p->wakeat == 0){
+      p->wakeat = when;
+      for(pp = &timers.head; *pp && (*pp)->wakeat <= when; pp = &(*pp)->tnext)
+        ;
+      p->tnext = *pp;
+      *pp = p;
+      if(timers.head == p)
+        timerarm(when);
+    }
+    sleep(&p->wakeat, &timers.lock);
+  }
+  if(p->wakeat)
+    timerremove(p);
+  release(&timers.lock);
+  return 0;
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if timer interrupt and the current process should yield,
+// 1 if other device or timer interrupt,
 // 0 if not recognized.
 int
 devintr()
@@ -202,18 +336,28 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if(cpuid() == 0){
-      clockintr();
-    }
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.  It may be
+    // for a tick, or for a timer deadline, or to wake an idle
+    // CPU, or several of these.
+    int id = cpuid();
+    uint64 tickat = __atomic_load_n(&timer_scratch[id][6], __ATOMIC_RELAXED);
+    int tick = tickat != mycpu()->tickat;
+
+    mycpu()->tickat = tickat;
+    clockintr();
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    timerintr();
+    if(tick)
+      schedtick();
+
+    // ask the caller to yield() if schedtick() or kick()
+    // in proc.c wants this CPU to reschedule.
+    return __atomic_exchange_n(&mycpu()->resched, 0, __ATOMIC_RELAXED) ? 2 : 1;
   } else {
     return 0;
   }
@@ -31,6 +31,10 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int extents;  // build an FS_EXTENTS file system (-e)
+int dirindex; // build an FS_DIRINDEX file system (-d)
+struct dirent rootde[DXROOT*DPB];
+int nrootde;
 
 
 void balloc(int);
@@ -40,6 +44,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint inum, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -76,9 +81,22 @@ main(int argc, char *argv[])
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
+  static_assert(sizeof(din.addrs) == NEXTENT*sizeof(struct extent) + sizeof(uint),
+                "Extents must fill addrs");
+
+  while(argc > 1 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-e") == 0)
+      extents = 1;
+    else if(strcmp(argv[1], "-d") == 0)
+      dirindex = 1;
+    else
+      break;
+    argc--;
+    argv++;
+  }
 
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] [-d] fs.img files...\n");
     exit(1);
   }
 
@@ -101,6 +119,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.features = xint((extents ? FS_EXTENTS : 0) | (dirindex ? FS_DIRINDEX : 0));
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -120,12 +139,12 @@ main(int argc, char *argv[])
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  rootde[nrootde++] = de;
 
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootde[nrootde++] = de;
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -152,7 +171,8 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nrootde < DXROOT*DPB);
+    rootde[nrootde++] = de;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,10 +180,12 @@ main(int argc, char *argv[])
     close(fd);
   }
 
+  dirappend(rootino, rootde, nrootde);
+
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  off = ((off + BSIZE - 1)/BSIZE) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
 
@@ -235,20 +257,188 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < nbitmap*BPB);
+  for(b = 0; b*BPB < used; b++){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB && b*BPB + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart+b);
+    wsect(sb.bmapstart+b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Same as the kernel's dxhash().
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+dxcmp(const void *a, const void *b)
+{
+  uint ha = dxhash(((struct dirent*)a)->name);
+  uint hb = dxhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the n entries de[], starting with "." and "..", to
+// directory inum.  With -d, a directory that needs more than
+// one block gets a one-level hash index (see fs.h), with the
+// leaves three-quarters full to leave room for new names.
+void
+dirappend(uint inum, struct dirent *de, int n)
+{
+  char buf[BSIZE];
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint first[DXROOT];
+  int i, nleaf, fill;
+
+  if(!dirindex || n <= DPB){
+    iappend(inum, de, n * sizeof(*de));
+    return;
+  }
+
+  qsort(de + 2, n - 2, sizeof(*de), dxcmp);
+
+  // find where each leaf starts; equal hashes share a leaf.
+  nleaf = 0;
+  fill = DPB;
+  for(i = 2; i < n; i++){
+    if(fill >= DPB*3/4 && (nleaf == 0 || dxhash(de[i].name) != dxhash(de[i-1].name))){
+      assert(nleaf < DXROOT);
+      first[nleaf++] = i;
+      fill = 0;
+    }
+    assert(fill < DPB);
+    fill++;
+  }
+
+  bzero(buf, sizeof(buf));
+  memmove(buf, de, 2 * sizeof(*de));
+  hd = (struct dxhead*)(buf + 2 * sizeof(*de));
+  hd->magic = xint(DXMAGIC);
+  hd->count = xint(nleaf);
+  e = (struct dxentry*)(hd + 1);
+  for(i = 0; i < nleaf; i++){
+    e[i].hash = xint(i == 0 ? 0 : dxhash(de[first[i]].name));
+    e[i].block = xint(i + 1);
+  }
+  iappend(inum, buf, BSIZE);
+
+  for(i = 0; i < nleaf; i++){
+    bzero(buf, sizeof(buf));
+    fill = (i + 1 < nleaf ? first[i+1] : n) - first[i];
+    memmove(buf, de + first[i], fill * sizeof(*de));
+    iappend(inum, buf, BSIZE);
+  }
+}
+
+// Like fblock(), for an extent-mapped file.  Blocks are
+// handed out in order, so a file's extent only breaks when
+// another file allocated a block in between.
+uint
+eblock(struct dinode *din, uint fbn)
+{
+  struct extent x[NXEXTENT], *e, *last;
+  uint off, ob, addr;
+  int i;
+
+  ob = xint(din->addrs[2*NEXTENT]);
+  if(ob)
+    rsect(ob, (char*)x);
+  else
+    bzero(x, sizeof(x));
+
+  off = 0;
+  last = 0;
+  for(i = 0; i < NEXTENT + NXEXTENT; i++){
+    e = i < NEXTENT ? (struct extent*)din->addrs + i : &x[i - NEXTENT];
+    if(xint(e->len) == 0)
+      break;
+    if(fbn < off + xint(e->len))
+      return xint(e->start) + fbn - off;
+    off += xint(e->len);
+    last = e;
+  }
+  assert(fbn == off);
+
+  if(last && xint(last->start) + xint(last->len) == freeblock){
+    last->len = xint(xint(last->len) + 1);
+  } else {
+    assert(i < NEXTENT + NXEXTENT);
+    if(i >= NEXTENT && ob == 0){
+      ob = freeblock++;
+      din->addrs[2*NEXTENT] = xint(ob);
+    }
+    e->start = xint(freeblock);
+    e->len = xint(1);
+  }
+  if(ob)
+    wsect(ob, (char*)x);
+  addr = freeblock++;
+  return addr;
+}
+
+// Return the block that holds block fbn of the file with
+// inode din, allocating it and any indirect blocks on the way.
+uint
+fblock(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, n, i;
+  int level;
+
+  if(extents)
+    return eblock(din, fbn);
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  // singly, doubly, or triply indirect?
+  for(level = 1, n = NINDIRECT; level <= 3 && fbn >= n; level++, n *= NINDIRECT)
+    fbn -= n;
+  assert(level <= 3);
+
+  if(xint(din->addrs[NDIRECT+level-1]) == 0){
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  }
+  addr = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--){
+    n /= NINDIRECT;
+    i = fbn / n;
+    rsect(addr, (char*)indirect);
+    if(indirect[i] == 0){
+      indirect[i] = xint(freeblock++);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[i]);
+    fbn %= n;
+  }
+  return addr;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +446,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -265,22 +454,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fblock(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
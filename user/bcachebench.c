@@ -0,0 +1,116 @@
+// Buffer cache contention benchmark.
+//
+// Each of n processes creates its own small file and then
+// reads it over and over.  Every block stays cached, so the
+// run is dominated by buffer cache lookups; with a per-bucket
+// locked cache the readers should rarely spin on bcache locks.
+// Reports the elapsed time, and the spins on bcache locks and
+// on the buffers' own locks, for each n.
+//
+// usage: bcachebench [maxprocs]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NBLOCK  4    // blocks per file
+#define NROUND  200  // times each process reads its file
+
+char buf[BSIZE];
+
+void
+mkname(char *name, int i)
+{
+  strcpy(name, "bcbench0");
+  name[7] = '0' + i;
+}
+
+void
+reader(int i)
+{
+  char name[16];
+  int fd, j, k;
+
+  mkname(name, i);
+  for(j = 0; j < NROUND; j++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("bcachebench: open %s failed\n", name);
+      exit(1);
+    }
+    for(k = 0; k < NBLOCK; k++){
+      if(read(fd, buf, BSIZE) != BSIZE){
+        printf("bcachebench: read %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[16];
+  int maxprocs, n, i, fd, t0, t1, s0, s1, xstatus;
+  struct bcstat st0, st1;
+
+  maxprocs = 4;
+  if(argc > 1)
+    maxprocs = atoi(argv[1]);
+  if(maxprocs < 1 || maxprocs > 10){
+    fprintf(2, "usage: bcachebench [maxprocs (1-10)]\n");
+    exit(1);
+  }
+
+  memset(buf, 'b', sizeof(buf));
+  for(i = 0; i < maxprocs; i++){
+    mkname(name, i);
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("bcachebench: create %s failed\n", name);
+      exit(1);
+    }
+    for(n = 0; n < NBLOCK; n++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("bcachebench: write %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  for(n = 1; n <= maxprocs; n++){
+    s0 = lockstat("bcache");
+    bcachestat(&st0);
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("bcachebench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        reader(i);
+    }
+    for(i = 0; i < n; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t1 = uptime();
+    s1 = lockstat("bcache");
+    bcachestat(&st1);
+    printf("bcachebench: %d procs: %d block reads in %d ticks, %d bcache spins, %d buffer spins\n",
+           n, n * NROUND * NBLOCK, t1 - t0, s1 - s0, st1.lockts - st0.lockts);
+  }
+
+  for(i = 0; i < maxprocs; i++){
+    mkname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
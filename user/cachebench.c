@@ -0,0 +1,87 @@
+// Buffer cache hit rate benchmark.
+//
+// For working sets of growing size, writes a file of that many
+// blocks, reads it through once to warm the cache, and then
+// reports the hit rate and time of a second pass.  The hit rate
+// should stay near 100% until the file no longer fits in the
+// largest cache the kernel allows, then fall off.
+//
+// usage: cachebench [maxblocks]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define CHUNK 8  // blocks per read() or write()
+
+char buf[CHUNK*BSIZE];
+
+void
+pass(int nblock)
+{
+  int fd, i;
+
+  if((fd = open("cachebench.f", O_RDONLY)) < 0){
+    printf("cachebench: open failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nblock; i += CHUNK){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("cachebench: read failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bcstat st0, st1;
+  int max, n, i, fd, t0, hits, total;
+
+  max = 32768;
+  if(argc > 1)
+    max = atoi(argv[1]);
+  if(max < CHUNK){
+    fprintf(2, "usage: cachebench [maxblocks]\n");
+    exit(1);
+  }
+
+  bcachestat(&st0);
+  printf("cachebench: cache has %d buffers, may grow to %d\n", st0.nbuf, st0.maxbuf);
+
+  for(n = 16; n <= max; n *= 2){
+    n = (n + CHUNK - 1) / CHUNK * CHUNK;
+    if((fd = open("cachebench.f", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+      printf("cachebench: create failed\n");
+      exit(1);
+    }
+    memset(buf, 'c', sizeof(buf));
+    for(i = 0; i < n; i += CHUNK){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("cachebench: write failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+
+    pass(n);
+    bcachestat(&st0);
+    t0 = uptime();
+    pass(n);
+    t0 = uptime() - t0;
+    bcachestat(&st1);
+
+    hits = st1.hits - st0.hits;
+    total = hits + st1.misses - st0.misses;
+    if(total == 0)
+      total = 1;
+    printf("cachebench: %d blocks: %d%% hits, %d ticks, cache %d buffers\n",
+           n, hits * 100 / total, t0, st1.nbuf);
+    unlink("cachebench.f");
+  }
+  exit(0);
+}
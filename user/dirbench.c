@@ -0,0 +1,92 @@
+// Large directory benchmark.
+//
+// Adds n names to a fresh directory, looks each of them up,
+// and removes them again, reporting the time for each phase.
+// The names are hard links to one file, so the run needs no
+// free inodes, and n is at most MAXLINK-1.  Without a directory index every phase is
+// quadratic in n; on a file system made with mkfs -d
+// (make DIRINDEX=1) each name costs a few block reads.
+//
+// usage: dirbench [n]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define DIR "dirbench.d"
+
+// dirbench.d/eNNNNN
+void
+mkname(char *name, int i)
+{
+  int j;
+
+  strcpy(name, DIR "/e00000");
+  for(j = strlen(name) - 1; i > 0; j--, i /= 10)
+    name[j] = '0' + i % 10;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[32];
+  struct stat st;
+  int n, i, fd, t0;
+
+  n = 10000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > MAXLINK - 1){
+    fprintf(2, "usage: dirbench [n]\n");
+    exit(1);
+  }
+
+  if(mkdir(DIR) < 0){
+    printf("dirbench: mkdir %s failed\n", DIR);
+    exit(1);
+  }
+  if((fd = open(DIR "/f", O_CREATE|O_RDWR)) < 0){
+    printf("dirbench: create failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(link(DIR "/f", name) < 0){
+      printf("dirbench: link %s failed\n", name);
+      exit(1);
+    }
+  }
+  printf("dirbench: %d creates in %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(stat(name, &st) < 0){
+      printf("dirbench: stat %s failed\n", name);
+      exit(1);
+    }
+  }
+  printf("dirbench: %d lookups in %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(unlink(name) < 0){
+      printf("dirbench: unlink %s failed\n", name);
+      exit(1);
+    }
+  }
+  printf("dirbench: %d deletes in %d ticks\n", n, uptime() - t0);
+
+  unlink(DIR "/f");
+  if(unlink(DIR) < 0){
+    printf("dirbench: rmdir %s failed\n", DIR);
+    exit(1);
+  }
+  exit(0);
+}
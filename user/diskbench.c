@@ -0,0 +1,129 @@
+// Disk throughput benchmark.
+//
+// Each of n processes reads its own file, which together
+// are larger than the buffer cache, so nearly every block
+// read goes to the disk.  Every reader keeps one request in
+// flight, so n is the disk queue depth; throughput should
+// grow with n until the device or the driver saturates.
+// Each run is repeated with reads of 1 and of 8 blocks per
+// read() call; the kernel reads the 8 blocks of a larger read,
+// which are consecutive on disk, with a single disk request.
+//
+// usage: diskbench [maxprocs]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NBLOCK  64  // blocks per file
+#define NROUND  4   // times each process reads its file
+#define MAXCHUNK 8  // max blocks per read() call
+
+char buf[MAXCHUNK*BSIZE];
+
+void
+mkname(char *name, int i)
+{
+  strcpy(name, "dbench0");
+  name[6] = '0' + i;
+}
+
+void
+reader(int i, int chunk)
+{
+  char name[16];
+  int fd, j, k;
+
+  mkname(name, i);
+  for(j = 0; j < NROUND; j++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("diskbench: open %s failed\n", name);
+      exit(1);
+    }
+    for(k = 0; k < NBLOCK; k += chunk){
+      if(read(fd, buf, chunk*BSIZE) != chunk*BSIZE){
+        printf("diskbench: read %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  exit(0);
+}
+
+// Run n readers at once, reading chunk blocks per call.
+void
+run(int n, int chunk)
+{
+  int i, t0, t1, xstatus, blocks;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("diskbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      reader(i, chunk);
+  }
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t1 = uptime();
+  if(t1 == t0)
+    t1 = t0 + 1;
+  blocks = n * NROUND * NBLOCK;
+  // a tick is about 1/10th of a second.
+  printf("diskbench: depth %d, %d-block reads: %d blocks in %d ticks, %d blocks/sec\n",
+         n, chunk, blocks, t1 - t0, blocks * 10 / (t1 - t0));
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[16];
+  int maxprocs, n, i, fd, t0, t1, chunk;
+
+  maxprocs = 8;
+  if(argc > 1)
+    maxprocs = atoi(argv[1]);
+  if(maxprocs < 1 || maxprocs > 10){
+    fprintf(2, "usage: diskbench [maxprocs (1-10)]\n");
+    exit(1);
+  }
+
+  memset(buf, 'd', sizeof(buf));
+  t0 = uptime();
+  for(i = 0; i < maxprocs; i++){
+    mkname(name, i);
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("diskbench: create %s failed\n", name);
+      exit(1);
+    }
+    for(n = 0; n < NBLOCK; n++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("diskbench: write %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  t1 = uptime();
+  printf("diskbench: wrote %d blocks in %d ticks\n", maxprocs * NBLOCK, t1 - t0);
+
+  for(chunk = 1; chunk <= MAXCHUNK; chunk *= MAXCHUNK)
+    for(n = 1; n <= maxprocs; n *= 2)
+      run(n, chunk);
+
+  for(i = 0; i < maxprocs; i++){
+    mkname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
@@ -0,0 +1,55 @@
+// Exec latency benchmark.
+//
+// Times fork+exec+exit+wait of a small program (echo) and of
+// the large usertests binary, which only prints its usage
+// message.  With demand-paged exec the two should cost about
+// the same, since each touches only a few pages of its binary.
+//
+// usage: execbench [n]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+runexec(char **argv, int n)
+{
+  int i, pid, t0, xstatus;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);  // discard the program's output
+      exec(argv[0], argv);
+      exit(1);
+    }
+    wait(&xstatus);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *small[] = { "echo", 0 };
+  char *big[] = { "usertests", "-x", 0 };
+  int n, t;
+
+  n = 50;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: execbench [n]\n");
+    exit(1);
+  }
+
+  t = runexec(small, n);
+  printf("execbench: %d execs of %s in %d ticks\n", n, small[0], t);
+  t = runexec(big, n);
+  printf("execbench: %d execs of %s in %d ticks\n", n, big[0], t);
+  exit(0);
+}
@@ -0,0 +1,78 @@
+// Page allocator throughput benchmark.
+//
+// For n = 1 .. maxprocs, fork n children that each repeatedly
+// grow their heap by NPAGE pages, touch every page, and shrink
+// it again, so that every round trip is NPAGE kalloc()s and
+// NPAGE kfree()s.  Reports aggregate pages per second for each n;
+// with per-CPU free lists it should scale with the number of harts.
+//
+// usage: kallocbench [maxprocs]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGE   64   // pages per round
+#define NROUND  200  // rounds per child
+
+void
+hammer(void)
+{
+  char *a, *p;
+  int i;
+
+  for(i = 0; i < NROUND; i++){
+    a = sbrk(NPAGE*PGSIZE);
+    if(a == (char*)-1){
+      printf("kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(p = a; p < a + NPAGE*PGSIZE; p += PGSIZE)
+      *p = i;
+    if(sbrk(-NPAGE*PGSIZE) == (char*)-1){
+      printf("kallocbench: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxprocs, n, i, t0, t1, xstatus, pages;
+
+  maxprocs = 4;
+  if(argc > 1)
+    maxprocs = atoi(argv[1]);
+  if(maxprocs < 1){
+    fprintf(2, "usage: kallocbench [maxprocs]\n");
+    exit(1);
+  }
+
+  for(n = 1; n <= maxprocs; n++){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("kallocbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        hammer();
+    }
+    for(i = 0; i < n; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t1 = uptime();
+    if(t1 == t0)
+      t1 = t0 + 1;
+    pages = n * NROUND * NPAGE;
+    // a tick is about 1/10th of a second.
+    printf("kallocbench: %d procs: %d pages in %d ticks, %d pages/sec\n",
+           n, pages, t1 - t0, pages * 10 / (t1 - t0));
+  }
+  exit(0);
+}
@@ -0,0 +1,117 @@
+// Interactive latency benchmark.
+//
+// A client and a server process trade a byte over pipes, with
+// the client "thinking" for THINK ms between requests, the way
+// a shell waits for typing.  The run is repeated alone, beside
+// CPU-bound background processes, and beside the same processes
+// after they call nice().  With the feedback queue scheduler the
+// background sinks to the lowest priority, so requests should
+// take little longer than their think time.
+//
+// usage: latbench [nbackground]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NREQ 50
+#define THINK 20        // ms per request
+#define MAXBG 32
+
+volatile int sink;
+
+// Time NREQ requests, returning the average ms each spends
+// beyond its think time.
+int
+interact(void)
+{
+  int a[2], b[2], i, pid, t0, t;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("latbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("latbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    while(read(a[0], &c, 1) == 1)
+      write(b[1], &c, 1);
+    exit(0);
+  }
+  close(a[0]);
+  close(b[1]);
+  c = 'x';
+  t0 = uptime();
+  for(i = 0; i < NREQ; i++){
+    nanosleep(THINK * 1000000ULL);
+    if(write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1){
+      printf("latbench: request failed\n");
+      exit(1);
+    }
+  }
+  t = uptime() - t0;
+  close(a[1]);
+  close(b[0]);
+  wait(0);
+  return (t * 100 - NREQ * THINK) / NREQ;  // a tick is 100 ms
+}
+
+// Start n CPU-bound processes, at the given nice increment.
+void
+background(int *pids, int n, int inc)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("latbench: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      nice(inc);
+      for(;;)
+        sink++;
+    }
+  }
+}
+
+void
+stop(int *pids, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, pids[MAXBG];
+
+  n = 8;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > MAXBG){
+    fprintf(2, "usage: latbench [nbackground]\n");
+    exit(1);
+  }
+
+  printf("latbench: alone: %d ms extra per request\n", interact());
+
+  background(pids, n, 0);
+  printf("latbench: %d background: %d ms extra per request\n", n, interact());
+  stop(pids, n);
+
+  background(pids, n, 100);
+  printf("latbench: %d niced background: %d ms extra per request\n", n, interact());
+  stop(pids, n);
+
+  exit(0);
+}
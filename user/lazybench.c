@@ -0,0 +1,57 @@
+// Sparse heap benchmark for lazy sbrk.
+//
+// Reserves a large heap with one sbrk() call, touches one page
+// out of every stride pages, and releases it again.  With lazy
+// allocation the cost should follow the number of pages touched,
+// not the size of the reservation.
+//
+// usage: lazybench [megabytes]
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NROUND 10
+
+int strides[] = { 1, 4, 16, 64, 256, 1024 };
+
+int
+main(int argc, char *argv[])
+{
+  int mb, i, j, t0, t1, touched;
+  uint64 len;
+  char *a, *p;
+
+  mb = 32;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    fprintf(2, "usage: lazybench [megabytes]\n");
+    exit(1);
+  }
+  len = (uint64)mb * 1024 * 1024;
+
+  for(i = 0; i < sizeof(strides)/sizeof(strides[0]); i++){
+    touched = 0;
+    t0 = uptime();
+    for(j = 0; j < NROUND; j++){
+      a = sbrk(len);
+      if(a == (char*)-1){
+        printf("lazybench: sbrk(%d MB) failed\n", mb);
+        exit(1);
+      }
+      for(p = a; p < a + len; p += strides[i] * PGSIZE){
+        *p = 1;
+        touched++;
+      }
+      if(sbrk(-len) == (char*)-1){
+        printf("lazybench: sbrk shrink failed\n");
+        exit(1);
+      }
+    }
+    t1 = uptime();
+    printf("lazybench: %d MB heap, stride %d: %d pages touched in %d ticks\n",
+           mb, strides[i], touched, t1 - t0);
+  }
+  exit(0);
+}
@@ -0,0 +1,95 @@
+// Context switch benchmark.
+//
+// Two processes bounce a byte over a pair of pipes, so every
+// round trip is two sleeps, two wakeups and at least two
+// context switches.  The run is repeated with more and more
+// idle processes (blocked reading a pipe) in the process
+// table; with per-CPU run queues the cost of a switch should
+// not grow with them.
+//
+// usage: schedbench [rounds]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXIDLE 1024
+
+int
+pingpong(int rounds)
+{
+  int a[2], b[2], i, pid, t0;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  c = 'x';
+  for(i = 0; i < rounds; i++){
+    if(write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1){
+      printf("schedbench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  close(b[1]);
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds, idle, n, i, p[2], t;
+  char c;
+
+  rounds = 5000;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds < 1){
+    fprintf(2, "usage: schedbench [rounds]\n");
+    exit(1);
+  }
+
+  if(pipe(p) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  idle = 0;
+  for(n = 0; n <= MAXIDLE; n = n ? 2*n : 8){
+    for(; idle < n; idle++){
+      int pid = fork();
+      if(pid < 0){
+        printf("schedbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        close(p[1]);
+        read(p[0], &c, 1);  // blocks until the parent closes p[1]
+        exit(0);
+      }
+    }
+    t = pingpong(rounds);
+    printf("schedbench: %d idle procs: %d round trips in %d ticks\n", idle, rounds, t);
+  }
+
+  close(p[1]);
+  for(i = 0; i < idle; i++)
+    wait(0);
+  exit(0);
+}
@@ -16,16 +16,18 @@
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, me, t0;
   char path[] = "stressfs0";
   char data[512];
 
   printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
 
+  t0 = uptime();
   for(i = 0; i < 4; i++)
     if(fork() > 0)
       break;
+  me = i;
 
   printf("write %d\n", i);
 
@@ -45,5 +47,10 @@ main(int argc, char *argv[])
 
   wait(0);
 
+  // each process waits for the one it forked, so the
+  // first one finishes last.
+  if(me == 0)
+    printf("stressfs: %d ticks\n", uptime() - t0);
+
   exit(0);
 }
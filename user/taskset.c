@@ -0,0 +1,82 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// CPU masks are in hex, bit i for CPU i, as in Linux.
+int
+parsemask(char *s, uint64 *mask)
+{
+  int c;
+
+  if(*s == 0)
+    return -1;
+  for(*mask = 0; (c = *s) != 0; s++){
+    if(c >= '0' && c <= '9')
+      c -= '0';
+    else if(c >= 'a' && c <= 'f')
+      c -= 'a' - 10;
+    else if(c >= 'A' && c <= 'F')
+      c -= 'A' - 10;
+    else
+      return -1;
+    *mask = *mask * 16 + c;
+  }
+  return 0;
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: taskset mask command [arg...]\n");
+  fprintf(2, "       taskset -p [mask] pid\n");
+  fprintf(2, "       taskset -s\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedstat st;
+  uint64 mask;
+  int i, pid;
+
+  if(argc == 2 && strcmp(argv[1], "-s") == 0){
+    // per-CPU context switch and migration counts.
+    for(i = 0; i < NCPU; i++){
+      if(cpustat(i, &st) < 0 || !st.online)
+        continue;
+      printf("cpu %d: %d switches, %d migrations\n", i, st.nswitch, st.nmigrate);
+    }
+    exit(0);
+  }
+
+  if(argc >= 3 && strcmp(argv[1], "-p") == 0){
+    pid = atoi(argv[argc-1]);
+    if(argc == 4){
+      if(parsemask(argv[2], &mask) < 0)
+        usage();
+      if(sched_setaffinity(pid, mask) < 0){
+        fprintf(2, "taskset: cannot set affinity of %d\n", pid);
+        exit(1);
+      }
+    } else if(argc != 3)
+      usage();
+    if(sched_getaffinity(pid, &mask) < 0){
+      fprintf(2, "taskset: no process %d\n", pid);
+      exit(1);
+    }
+    printf("pid %d's affinity mask: %x\n", pid, (int)mask);
+    exit(0);
+  }
+
+  if(argc < 3 || parsemask(argv[1], &mask) < 0)
+    usage();
+  if(sched_setaffinity(0, mask) < 0){
+    fprintf(2, "taskset: no running CPU in mask %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,73 @@
+// Sleep and timer benchmark.
+//
+// First times a run of short nanosleep() calls, which should
+// each take about as long as asked rather than a whole tick.
+// Then times a fixed amount of computation while more and more
+// processes sit in long sleep() calls.  Sleepers are woken only
+// at their deadlines, so they should not slow the computation
+// down, however many there are.
+//
+// usage: timerbench [n]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NSLEEPER 512
+
+volatile int sink;
+int pids[NSLEEPER];
+
+int
+compute(int n)
+{
+  int i, j, t0;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    for(j = 0; j < 1000000; j++)
+      sink += j;
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, t0, nsleep;
+
+  n = 50;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: timerbench [n]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < 100; i++)
+    nanosleep(1000000);
+  printf("timerbench: 100 1ms nanosleeps in %d ticks\n", uptime() - t0);
+
+  nsleep = 0;
+  for(;;){
+    printf("timerbench: %d sleepers: compute in %d ticks\n", nsleep, compute(n));
+    if(nsleep == NSLEEPER)
+      break;
+    for(i = nsleep ? 2*nsleep : 8; nsleep < i && nsleep < NSLEEPER; nsleep++){
+      pids[nsleep] = fork();
+      if(pids[nsleep] < 0){
+        printf("timerbench: fork failed\n");
+        exit(1);
+      }
+      if(pids[nsleep] == 0){
+        sleep(1000000);
+        exit(0);
+      }
+    }
+  }
+
+  for(i = 0; i < nsleep; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+  exit(0);
+}
@@ -1,4 +1,6 @@
 struct stat;
+struct bcstat;
+struct schedstat;
 
 // system calls
 int fork(void);
@@ -22,6 +24,15 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lockstat(const char*);
+int fsync(int);
+int bcachestat(struct bcstat*);
+int nanosleep(uint64);
+int nice(int);
+int sched_setaffinity(int, uint64);
+int sched_getaffinity(int, uint64*);
+int cpustat(int, struct schedstat*);
+int waitpid(int, int*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -575,6 +575,47 @@ writetest(char *s)
   }
 }
 
+// fsync() of a file with unwritten changes, of a pipe,
+// and of a bad fd.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2];
+
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1){
+    printf("%s: write fsyncf failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: second fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0 || fsync(fds[0]) != 0){
+    printf("%s: fsync of pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("fsyncf");
+}
+
+// enough blocks to need doubly-indirect blocks.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 4*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -586,7 +627,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +647,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == BIGBLOCKS - 1){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -730,6 +771,83 @@ exectest(char *s)
 
 }
 
+// a program's file can't be written or truncated while it runs,
+// since its pages are read from the file as they are touched.
+void
+textbusy(char *s)
+{
+  int fd, out, n, pid, xstatus, in[2], res[2];
+  char *argv[] = { "textbusy.bin", 0 };
+  char c;
+
+  // run a copy of cat, so that a failure can't damage cat.
+  fd = open("cat", O_RDONLY);
+  out = open("textbusy.bin", O_CREATE|O_TRUNC|O_WRONLY);
+  if(fd < 0 || out < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(out, buf, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(out);
+
+  if(pipe(in) < 0 || pipe(res) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(res[1]);
+    close(in[0]);
+    close(in[1]);
+    close(res[0]);
+    close(res[1]);
+    exec("textbusy.bin", argv);
+    exit(1);
+  }
+  close(in[0]);
+  close(res[1]);
+
+  // once the copy echoes a byte, it is running.
+  if(write(in[1], "x", 1) != 1 || read(res[0], &c, 1) != 1){
+    printf("%s: program did not run\n", s);
+    exit(1);
+  }
+  if((fd = open("textbusy.bin", O_WRONLY)) >= 0){
+    if(write(fd, "x", 1) == 1){
+      printf("%s: wrote a running program\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  if((fd = open("textbusy.bin", O_WRONLY|O_TRUNC)) >= 0){
+    printf("%s: truncated a running program\n", s);
+    exit(1);
+  }
+
+  close(in[1]);
+  wait(&xstatus);
+  close(res[0]);
+  if((fd = open("textbusy.bin", O_WRONLY|O_TRUNC)) < 0){
+    printf("%s: can't truncate after the program exited\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("textbusy.bin");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -815,6 +933,156 @@ killstatus(char *s)
   exit(0);
 }
 
+// sleep() and nanosleep() wait long enough, finer-grained
+// sleeps don't round up to whole ticks, and kill() ends a
+// long sleep early.
+void
+sleeptest(char *s)
+{
+  int i, t0, pid, xst;
+
+  t0 = uptime();
+  if(nanosleep(200000000) != 0){
+    printf("%s: nanosleep failed\n", s);
+    exit(1);
+  }
+  if(uptime() - t0 < 1){
+    printf("%s: nanosleep returned early\n", s);
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < 20; i++)
+    nanosleep(1000000);
+  if(uptime() - t0 >= 10){
+    printf("%s: 20 1ms nanosleeps took %d ticks\n", s, uptime() - t0);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(100000);
+    exit(0);
+  }
+  sleep(1);
+  t0 = uptime();
+  kill(pid);
+  wait(&xst);
+  if(xst != -1 || uptime() - t0 > 10){
+    printf("%s: kill did not end sleep\n", s);
+    exit(1);
+  }
+}
+
+// nice() clamps to [0, NPRIO-1], and children inherit it.
+void
+nicetest(char *s)
+{
+  int pid, xst;
+
+  if(nice(0) != 0 || nice(1) != 1 || nice(-100) != 0 || nice(100) != NPRIO-1){
+    printf("%s: nice returned wrong value\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(nice(0) == NPRIO-1 ? 0 : 1);
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child did not inherit nice\n", s);
+    exit(1);
+  }
+}
+
+// sched_setaffinity() pins a process, children inherit the
+// mask, and bad masks and pids are refused.
+void
+affinitytest(char *s)
+{
+  uint64 mask;
+  int pid, xst;
+
+  if(sched_setaffinity(0, 1) != 0){
+    printf("%s: sched_setaffinity failed\n", s);
+    exit(1);
+  }
+  if(sched_getaffinity(0, &mask) != 0 || mask != 1){
+    printf("%s: sched_getaffinity wrong\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 0) != -1 || sched_setaffinity(0, 1L << NCPU) != -1){
+    printf("%s: empty mask accepted\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(-1, 1) != -1 || sched_getaffinity(-1, &mask) != -1){
+    printf("%s: bad pid accepted\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(sched_getaffinity(0, &mask) == 0 && mask == 1 ? 0 : 1);
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child did not inherit affinity\n", s);
+    exit(1);
+  }
+}
+
+// waitpid() reaps just the child asked for, with its status,
+// and refuses pids that aren't children.
+void
+waitpidtest(char *s)
+{
+  int pids[3], i, xst, pid;
+
+  for(i = 0; i < 3; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      sleep(i);
+      exit(10 + i);
+    }
+  }
+  if(waitpid(pids[2], &xst) != pids[2] || xst != 12){
+    printf("%s: waitpid of last child failed\n", s);
+    exit(1);
+  }
+  if(waitpid(pids[2], &xst) != -1){
+    printf("%s: waitpid of reaped child succeeded\n", s);
+    exit(1);
+  }
+  if(waitpid(getpid(), &xst) != -1 || waitpid(1, &xst) != -1){
+    printf("%s: waitpid of non-child succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2; i++){
+    pid = wait(&xst);
+    if((pid != pids[0] || xst != 10) && (pid != pids[1] || xst != 11)){
+      printf("%s: wait got pid %d status %d\n", s, pid, xst);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1 || waitpid(-1, 0) != -1){
+    printf("%s: wait with no children succeeded\n", s);
+    exit(1);
+  }
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -1959,7 +2227,7 @@ iref(char *s)
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = NPROC+1 };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1976,7 +2244,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -1993,6 +2261,41 @@ forktest(char *s)
   }
 }
 
+// more processes alive at once than the old
+// fixed-size process table could hold.
+void
+manyprocs(char *s)
+{
+  enum{ N = 200 };
+  int fds[2], i, pid;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork %d failed\n", s, i);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);  // blocks until the parent closes fds[1]
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < N; i++){
+    if(wait(0) < 0){
+      printf("%s: wait stopped early\n", s);
+      exit(1);
+    }
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2556,6 +2859,92 @@ sbrk8000(char *s)
 
 
 
+int countfree();
+
+// fork n pages of memory at a, then have the parent and the
+// child each write every page.  each must see only its own
+// writes.
+void
+cowpass(char *s, char *a, int n)
+{
+  int i, pid, xstatus, fds[2];
+  char c;
+
+  for(i = 0; i < n; i++)
+    a[i*4096] = i;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // wait until the parent has written its copy.
+    close(fds[1]);
+    if(read(fds[0], &c, 1) != 1)
+      exit(1);
+    for(i = 0; i < n; i++){
+      if(a[i*4096] != (char)i){
+        printf("%s: child sees parent's write to page %d\n", s, i);
+        exit(1);
+      }
+      a[i*4096] = 100 + i;
+    }
+    for(i = 0; i < n; i++){
+      if(a[i*4096] != (char)(100 + i)){
+        printf("%s: child lost its write to page %d\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  for(i = 0; i < n; i++)
+    a[i*4096] = 200 + i;
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(i = 0; i < n; i++){
+    if(a[i*4096] != (char)(200 + i)){
+      printf("%s: parent sees child's write to page %d\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// copy-on-write fork: parent and child get private copies of
+// the pages either writes, and once the child is gone and the
+// memory given back, every page's reference count is back to
+// where it was, so that no page is lost.
+void
+cowtest(char *s)
+{
+  enum { NPAGE = 64 };
+  int free0, free1;
+  char *a;
+
+  a = sbrk(NPAGE*4096);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  // once first, so that page-table pages for a are made.
+  cowpass(s, a, NPAGE);
+  free0 = countfree();
+  cowpass(s, a, NPAGE);
+  free1 = countfree();
+  if(free1 < free0){
+    printf("%s: lost %d pages\n", s, free0 - free1);
+    exit(1);
+  }
+  sbrk(-NPAGE*4096);
+}
+
 // regression test. test whether exec() leaks memory if one of the
 // arguments is invalid. the test passes if the kernel doesn't panic.
 void
@@ -2589,12 +2978,18 @@ struct test {
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
+  {fsynctest, "fsynctest"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {textbusy, "textbusy"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
+  {sleeptest, "sleeptest"},
+  {nicetest, "nicetest"},
+  {affinitytest, "affinitytest"},
+  {waitpidtest, "waitpidtest"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
@@ -2618,6 +3013,7 @@ struct test {
   {dirfile, "dirfile"},
   {iref, "iref"},
   {forktest, "forktest"},
+  {manyprocs, "manyprocs"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
   {kernmem, "kernmem"},
@@ -2634,6 +3030,7 @@ struct test {
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {cowtest, "cowtest"},
   {badarg, "badarg" },
 
   { 0, 0},
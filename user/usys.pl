@@ -36,3 +36,12 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("lockstat");
+entry("fsync");
+entry("bcachestat");
+entry("nanosleep");
+entry("nice");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("cpustat");
+entry("waitpid");